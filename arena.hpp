@@ -0,0 +1,241 @@
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <algorithm>
+
+#ifndef _arenaa
+#define _arenaa
+
+class Arena{
+    // This is a bump allocator for objects that only live for one frame.
+    // Memory is taken from big blocks by moving a pointer forward, and reset gives all of it
+    // back at once by moving the pointer to the start again. The blocks are kept for the next frame.
+    // Destructors are not called on reset, so only objects that don't own memory outside
+    // the arena belong here (Point, Mat4, and Transform/Mesh created with this arena).
+
+    private:
+
+        struct Block{
+            Block * next; // The block after this one
+            size_t size; // Bytes of data in the block
+            size_t used; // Bytes already given out
+        };
+
+        size_t block_size; // Size of a new block (a bigger one is made for a bigger request)
+        Block * first; // The first block, where every frame starts
+        Block * current; // The block allocations come from
+
+        // Counters
+        size_t frame_bytes; // Bytes given out since the last reset
+        long frame_allocations; // Allocations since the last reset
+        size_t last_bytes; // Bytes given out during the previous frame
+        long last_allocations; // Allocations during the previous frame
+        size_t reserved; // Bytes of all the blocks
+
+        static char * data(Block * b){
+            // The memory of the block comes right after its header
+            return (char *)b+sizeof(Block);
+        }
+
+        Block * new_block(size_t size){
+            Block * b = (Block *)::operator new(sizeof(Block)+size);
+            b->next = nullptr;
+            b->size = size;
+            b->used = 0;
+            reserved += size;
+            return b;
+        }
+
+    public:
+
+        Arena(size_t block = 1<<16){
+            // Creates the arena with its first block
+            block_size = block;
+            reserved = 0;
+            frame_bytes = last_bytes = 0;
+            frame_allocations = last_allocations = 0;
+            first = current = new_block(block_size);
+        }
+
+        ~Arena(){
+            // Delete all the blocks
+            while(first){
+                Block * next = first->next;
+                ::operator delete(first);
+                first = next;
+            }
+        }
+
+        void * allocate(size_t size, size_t align = alignof(std::max_align_t)){
+            // Gives out size bytes with the given alignment (a power of two)
+
+            while(true){
+                char * base = data(current);
+                size_t start = ((size_t)(base+current->used)+align-1)&~(align-1);
+                start -= (size_t)base;
+                if(start+size <= current->size){
+                    current->used = start+size;
+                    frame_bytes += size;
+                    frame_allocations++;
+                    return base+start;
+                }
+
+                // Move on to the next block, making one if there is none that fits
+                if(!current->next || current->next->size < size+align){
+                    Block * b = new_block(std::max(block_size,size+align));
+                    b->next = current->next;
+                    current->next = b;
+                }
+                current = current->next;
+                current->used = 0;
+            }
+
+        }
+
+        template <typename T, typename... Args>
+        T * make(Args&&... args){
+            // Creates an object in the arena
+            return new (allocate(sizeof(T),alignof(T))) T(std::forward<Args>(args)...);
+        }
+
+        template <typename T>
+        T * make_array(size_t n){
+            // Creates an array of default constructed objects in the arena
+            T * array = (T *)allocate(n*sizeof(T),alignof(T));
+            for(size_t i = 0; i < n; i++)
+                new (array+i) T();
+            return array;
+        }
+
+        void reset(){
+            // Gives back everything at once, in constant time
+            last_bytes = frame_bytes;
+            last_allocations = frame_allocations;
+            frame_bytes = 0;
+            frame_allocations = 0;
+            current = first;
+            current->used = 0;
+        }
+
+        // Getters for the counters
+        size_t getLiveBytes(){
+            return frame_bytes;
+        }
+
+        long getAllocations(){
+            return frame_allocations;
+        }
+
+        size_t getLastFrameBytes(){
+            return last_bytes;
+        }
+
+        long getLastFrameAllocations(){
+            return last_allocations;
+        }
+
+        size_t getReservedBytes(){
+            return reserved;
+        }
+
+};
+
+// Allows writing new (arena) Point(...), the object must never be deleted
+inline void * operator new(size_t size, Arena & arena){
+    return arena.allocate(size);
+}
+
+inline void * operator new[](size_t size, Arena & arena){
+    return arena.allocate(size);
+}
+
+// Only used by the compiler if a constructor throws
+inline void operator delete(void *, Arena &) noexcept{}
+inline void operator delete[](void *, Arena &) noexcept{}
+
+
+template <typename T>
+class Pool{
+    // This is a pool for objects that live longer than a frame, all of the same type.
+    // The objects are kept in big chunks, and a freed slot is reused by the next object.
+
+    private:
+
+        union Slot{
+            Slot * next; // The next free slot, while this one is free
+            alignas(T) char object[sizeof(T)];
+        };
+
+        struct Chunk{
+            Chunk * next;
+            Slot * slots;
+        };
+
+        int chunk_size; // Objects per chunk
+        Chunk * chunks; // All the chunks
+        Slot * free_slots; // The slots that can be used
+        long live; // Objects that exist at the moment
+
+    public:
+
+        Pool(int objects_per_chunk = 64){
+            chunk_size = (objects_per_chunk > 1)?objects_per_chunk:1;
+            chunks = nullptr;
+            free_slots = nullptr;
+            live = 0;
+        }
+
+        ~Pool(){
+            // The objects that are still alive are not destroyed, only their memory is freed
+            while(chunks){
+                Chunk * next = chunks->next;
+                delete[] chunks->slots;
+                delete chunks;
+                chunks = next;
+            }
+        }
+
+        template <typename... Args>
+        T * create(Args&&... args){
+            // Creates an object in a free slot, making a new chunk if needed
+
+            if(!free_slots){
+                Chunk * c = new Chunk;
+                c->slots = new Slot[chunk_size];
+                c->next = chunks;
+                chunks = c;
+                for(int i = 0; i < chunk_size; i++){
+                    c->slots[i].next = free_slots;
+                    free_slots = &c->slots[i];
+                }
+            }
+
+            Slot * s = free_slots;
+            free_slots = s->next;
+            live++;
+            return new (s->object) T(std::forward<Args>(args)...);
+
+        }
+
+        void destroy(T * object){
+            // Destroys an object of the pool and frees its slot
+            if(!object) return;
+            object->~T();
+            Slot * s = (Slot *)object;
+            s->next = free_slots;
+            free_slots = s;
+            live--;
+        }
+
+        // Getters for the counters
+        long getLiveObjects(){
+            return live;
+        }
+
+        size_t getLiveBytes(){
+            return live*sizeof(T);
+        }
+
+};
+
+#endif
@@ -0,0 +1,149 @@
+#include <cstdio>
+#include "space.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define BATCH_X86 1
+#endif
+
+#ifndef _batchh
+#define _batchh
+
+// Batch vertex transformation
+// The points are given as structure of arrays (one array for x, one for y, one for z, w is always 1)
+// and every point goes through the same matrix, followed by the homogenous divide.
+// The SIMD kernels run the four x/y/z/w lanes side by side for 4 (SSE) or 8 (AVX2) points at a time.
+// All the kernels perform the same float operations in the same order, so their results are identical.
+
+enum BatchKernel { BATCH_AUTO, BATCH_SCALAR, BATCH_SSE, BATCH_AVX2 };
+
+typedef void (*batch_function)(const float * mat, const float * x, const float * y, const float * z,
+    float * ox, float * oy, float * oz, int from, int to);
+
+void batch_scalar(const float * m, const float * x, const float * y, const float * z,
+    float * ox, float * oy, float * oz, int from, int to){
+    // Transforms the points one at a time, this is also used for the leftovers of the SIMD kernels
+
+    for(int i = from; i < to; i++){
+        float px = x[i], py = y[i], pz = z[i];
+        float tx = m[0]*px+m[1]*py+m[2]*pz+m[3];
+        float ty = m[4]*px+m[5]*py+m[6]*pz+m[7];
+        float tz = m[8]*px+m[9]*py+m[10]*pz+m[11];
+        float tw = m[12]*px+m[13]*py+m[14]*pz+m[15];
+        ox[i] = tx/tw;
+        oy[i] = ty/tw;
+        oz[i] = tz/tw;
+    }
+
+}
+
+#ifdef BATCH_X86
+
+void batch_sse(const float * m, const float * x, const float * y, const float * z,
+    float * ox, float * oy, float * oz, int from, int to){
+    // Transforms 4 points at a time with SSE
+
+    // Broadcast the matrix once
+    __m128 c[16];
+    for(int k = 0; k < 16; k++)
+        c[k] = _mm_set1_ps(m[k]);
+
+    int i = from;
+    for(; i+4 <= to; i += 4){
+        __m128 px = _mm_loadu_ps(x+i), py = _mm_loadu_ps(y+i), pz = _mm_loadu_ps(z+i);
+        __m128 lane[4];
+        for(int r = 0; r < 4; r++){
+            __m128 acc = _mm_add_ps(_mm_mul_ps(c[4*r],px),_mm_mul_ps(c[4*r+1],py));
+            acc = _mm_add_ps(acc,_mm_mul_ps(c[4*r+2],pz));
+            lane[r] = _mm_add_ps(acc,c[4*r+3]);
+        }
+        _mm_storeu_ps(ox+i,_mm_div_ps(lane[0],lane[3]));
+        _mm_storeu_ps(oy+i,_mm_div_ps(lane[1],lane[3]));
+        _mm_storeu_ps(oz+i,_mm_div_ps(lane[2],lane[3]));
+    }
+
+    // The rest are done one at a time
+    batch_scalar(m,x,y,z,ox,oy,oz,i,to);
+
+}
+
+__attribute__((target("avx2")))
+void batch_avx2(const float * m, const float * x, const float * y, const float * z,
+    float * ox, float * oy, float * oz, int from, int to){
+    // Transforms 8 points at a time with AVX2
+
+    // Broadcast the matrix once
+    __m256 c[16];
+    for(int k = 0; k < 16; k++)
+        c[k] = _mm256_set1_ps(m[k]);
+
+    int i = from;
+    for(; i+8 <= to; i += 8){
+        __m256 px = _mm256_loadu_ps(x+i), py = _mm256_loadu_ps(y+i), pz = _mm256_loadu_ps(z+i);
+        __m256 lane[4];
+        for(int r = 0; r < 4; r++){
+            __m256 acc = _mm256_add_ps(_mm256_mul_ps(c[4*r],px),_mm256_mul_ps(c[4*r+1],py));
+            acc = _mm256_add_ps(acc,_mm256_mul_ps(c[4*r+2],pz));
+            lane[r] = _mm256_add_ps(acc,c[4*r+3]);
+        }
+        _mm256_storeu_ps(ox+i,_mm256_div_ps(lane[0],lane[3]));
+        _mm256_storeu_ps(oy+i,_mm256_div_ps(lane[1],lane[3]));
+        _mm256_storeu_ps(oz+i,_mm256_div_ps(lane[2],lane[3]));
+    }
+
+    // The rest are done one at a time
+    batch_scalar(m,x,y,z,ox,oy,oz,i,to);
+
+}
+
+#endif
+
+// The kernel that is used, picked on the first call
+batch_function batch_selected = nullptr;
+
+int batch_select(int kernel = BATCH_AUTO){
+    // Picks the kernel used by transform_points, returns the one that was picked
+    // Asking for a kernel that the cpu does not support falls back to the best one it does
+
+#ifdef BATCH_X86
+    bool has_avx2 = __builtin_cpu_supports("avx2");
+    if(kernel == BATCH_AUTO) kernel = has_avx2?BATCH_AVX2:BATCH_SSE;
+    if(kernel == BATCH_AVX2 && !has_avx2) kernel = BATCH_SSE;
+#else
+    kernel = BATCH_SCALAR;
+#endif
+
+    switch(kernel){
+#ifdef BATCH_X86
+        case BATCH_AVX2: batch_selected = batch_avx2; break;
+        case BATCH_SSE: batch_selected = batch_sse; break;
+#endif
+        default: batch_selected = batch_scalar; kernel = BATCH_SCALAR;
+    }
+    return kernel;
+
+}
+
+void transform_points(const Mat4 & mat, const float * x, const float * y, const float * z,
+    float * ox, float * oy, float * oz, int n){
+    // Transforms n points by the matrix and divides them by their homogenous coord
+    // The outputs can be the same arrays as the inputs to transform in place
+
+    if(!batch_selected) batch_select();
+
+    // The kernels work in float
+    float m[16];
+    for(int r = 0; r < 4; r++)
+        for(int c = 0; c < 4; c++)
+            m[4*r+c] = (float)mat.m[r][c];
+
+    batch_selected(m,x,y,z,ox,oy,oz,0,n);
+
+}
+
+void transform_points(Transform * trans, const float * x, const float * y, const float * z,
+    float * ox, float * oy, float * oz, int n){
+    transform_points(trans->getMatrix(),x,y,z,ox,oy,oz,n);
+}
+
+#endif
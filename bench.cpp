@@ -0,0 +1,504 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <new>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "canvas.hpp"
+#include "loader.hpp"
+
+// Microbenchmarks for the math, the rasterization and the output
+// Every benchmark reports the time, the allocations and the bytes sent to the terminal per operation.
+// Usage: bench [output.json], the results are printed as JSON (to stdout if no file is given)
+
+
+Color Canvas::drawcolor(1,1,1);
+
+
+// Count every allocation of the program
+// The operators are kept out of line, inlined GCC sees malloc and free under new and delete and warns of a mismatch
+std::atomic<long> alloc_count(0);
+
+__attribute__((noinline)) void * operator new(size_t size){
+    alloc_count++;
+    void * p = malloc(size?size:1);
+    if(!p) throw std::bad_alloc();
+    return p;
+}
+
+__attribute__((noinline)) void * operator new[](size_t size){
+    alloc_count++;
+    void * p = malloc(size?size:1);
+    if(!p) throw std::bad_alloc();
+    return p;
+}
+
+__attribute__((noinline)) void operator delete(void * p) noexcept{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void * p) noexcept{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete(void * p, size_t) noexcept{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void * p, size_t) noexcept{
+    free(p);
+}
+
+
+struct Result{
+    // The measurements of one benchmark for one set of parameters
+    std::string name;
+    int width, height, aa, count; // The parameters, zero if they don't apply
+    long iterations; // How many times the benchmark ran
+    double ns_per_op;
+    double allocs_per_op;
+    double bytes_per_op;
+};
+
+std::vector<Result> results;
+volatile double sink; // Keeps the compiler from removing the math
+
+double seconds(){
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+template <typename F>
+void bench(const char * name, int width, int height, int aa, int count, int ops, F run, Canvas * canvas = nullptr){
+    // Runs the function until enough time has passed, every call counts for ops operations
+    // The bytes are taken from the emitter of the canvas, if there is one
+
+    // Warm up first
+    run();
+
+    long start_allocs = alloc_count;
+    long start_bytes = canvas?canvas->getEmitter()->getTotalBytes():0;
+    long iterations = 0;
+    double start = seconds(), elapsed = 0;
+    while(elapsed < 0.2 || iterations < 3){
+        run();
+        iterations++;
+        elapsed = seconds()-start;
+    }
+    long allocs = alloc_count-start_allocs;
+    long bytes = canvas?canvas->getEmitter()->getTotalBytes()-start_bytes:0;
+
+    double total = (double)iterations*ops;
+    Result r = {name,width,height,aa,count,iterations,elapsed*1e9/total,allocs/total,bytes/total};
+    results.push_back(r);
+    fprintf(stderr,"%-20s %4dx%-4d aa %d n %-5d %12.1f ns/op %8.2f allocs/op %10.1f bytes/op\n",
+        name,width,height,aa,count,r.ns_per_op,r.allocs_per_op,r.bytes_per_op);
+
+}
+
+void bench_math(){
+    // The transformation math, which does not depend on the canvas
+
+    Matrix<4,4> a, b;
+    Matrix<4,4,float> af, bf;
+    for(int i = 0; i < 4; i++)
+        for(int j = 0; j < 4; j++){
+            a.set(i,j,i+j*0.5);
+            b.set(i,j,i*0.25-j);
+            af.set(i,j,i+j*0.5f);
+            bf.set(i,j,i*0.25f-j);
+        }
+    bench("Matrix::mul",0,0,0,1,1,[&]{
+        b.mul(a);
+        b.m[3][3] = 1.0;
+        sink = b.get(0,0);
+    });
+    bench("Matrix<float>::mul",0,0,0,1,1,[&]{
+        bf.mul(af);
+        bf.m[3][3] = 1.0f;
+        sink = bf.get(0,0);
+    });
+    Matrix<4,1> v;
+    v.set(3,0,1.0);
+    bench("Matrix<4,1> product",0,0,0,1,1,[&]{
+        v = a*v;
+        v.m[3][0] = 1.0;
+        sink = v.get(0,0);
+    });
+
+    Mat4 m = matrix_rot_axis(0.3,1)*matrix_translate(1,2,3), n = matrix_per(10);
+    bench("Mat4::mul",0,0,0,1,1,[&]{
+        m = n*m;
+        m.m[3][3] = 1.0;
+        sink = m.m[0][0];
+    });
+
+    // Moving a camera: building it again every frame, or only setting its view slots
+    double angle = 0;
+    bench("transform_view_per",0,0,0,1,1,[&]{
+        Point position(80*cos(angle),80*sin(angle),30), direction(-cos(angle),-sin(angle),-0.9);
+        Transform * moved = transform_view_per(&position,&direction,100.0);
+        moved->add(matrix_translate(50,10,0));
+        sink = moved->getMatrix().m[0][0];
+        delete moved;
+        angle += 0.01;
+    });
+
+    Point viewpoint(80,20,30), viewdir(-1,-0.3,-0.9);
+    Transform * camera = transform_view_per(&viewpoint,&viewdir,100.0);
+    camera->push(matrix_translate(50,10,0));
+    bench("view_per",0,0,0,1,1,[&]{
+        Point position(80*cos(angle),80*sin(angle),30), direction(-cos(angle),-sin(angle),-0.9);
+        view_per(camera,&position,&direction,100.0);
+        sink = camera->getMatrix().m[0][0];
+        angle += 0.01;
+    });
+
+    // A child pushed on the camera and popped again, the camera itself is not multiplied again
+    bench("Transform::push",0,0,0,1,1,[&]{
+        camera->push(matrix_translate(angle,1,2));
+        sink = camera->getMatrix().m[0][0];
+        camera->pop();
+    });
+    camera->pop();
+    view_per(camera,&viewpoint,&viewdir,100.0);
+
+    // Finding the nearest palette color, over colors spread across the whole cube
+    const Palette * palette = palette_256();
+    std::vector<Color> samples(4096);
+    for(int i = 0; i < 4096; i++)
+        samples[i] = color_bytes((i*37)&255,(i*101)&255,(i*193)&255);
+    bench("Palette::nearest",0,0,0,4096,4096,[&]{
+        int total = 0;
+        for(Color c : samples)
+            total += palette->nearest(c);
+        sink = total;
+    });
+    for(int count : {1000,100000}){
+        Point * points = new Point[count];
+        bench("Point::transform",0,0,0,count,count,[&]{
+            for(int i = 0; i < count; i++){
+                points[i] = Point(i%17,i%13,i%11);
+                points[i].transform(camera);
+            }
+            sink = points[count-1].getX();
+        });
+        delete[] points;
+
+        float * x = new float[3*count], * y = x+count, * z = y+count;
+        for(int i = 0; i < count; i++){
+            x[i] = i%17;
+            y[i] = i%13;
+            z[i] = i%11;
+        }
+        float * out = new float[3*count];
+        bench("transform_points",0,0,0,count,count,[&]{
+            transform_points(camera,x,y,z,out,out+count,out+2*count,count);
+            sink = out[0];
+        });
+        delete[] x;
+        delete[] out;
+
+        // The cubes are counted by vertex, like the points
+        int cubes = count/8;
+        Mesh ** meshes = new Mesh*[cubes];
+        for(int i = 0; i < cubes; i++){
+            Point p1(i%10,i%7,i%5), p2(i%10+3,i%7+3,i%5+3);
+            meshes[i] = mesh_cube(&p1,&p2);
+        }
+        bench("Cube::transform",0,0,0,count,cubes*8,[&]{
+            for(int i = 0; i < cubes; i++)
+                meshes[i]->transform(camera);
+            sink = meshes[0]->getScreenX()[0];
+        });
+        for(int i = 0; i < cubes; i++)
+            delete meshes[i];
+        delete[] meshes;
+    }
+    delete camera;
+
+}
+
+void bench_loader(){
+    // Loading models from files, the model is a sphere made of a grid of quads
+    // It's written once as OBJ and as binary STL, the time is per triangle
+
+    const int rings = 400, segments = 800;
+    const char * obj_path = "bench_model.obj", * stl_path = "bench_model.stl";
+    FILE * obj = fopen(obj_path,"w"), * stl = fopen(stl_path,"wb");
+    if(!obj || !stl){
+        fprintf(stderr,"Could not write the models for the loader benchmarks\n");
+        if(obj) fclose(obj);
+        if(stl) fclose(stl);
+        return;
+    }
+    auto position = [&](int r, int s, float * v){
+        double a = M_PI*r/rings, b = 2*M_PI*(s%segments)/segments;
+        v[0] = sin(a)*cos(b);
+        v[1] = sin(a)*sin(b);
+        v[2] = cos(a);
+    };
+    for(int r = 0; r <= rings; r++)
+        for(int s = 0; s < segments; s++){
+            float v[3];
+            position(r,s,v);
+            fprintf(obj,"v %.6f %.6f %.6f\n",v[0],v[1],v[2]);
+        }
+    char header[80] = {0};
+    uint32_t count = 2*rings*segments;
+    fwrite(header,1,80,stl);
+    fwrite(&count,4,1,stl);
+    for(int r = 0; r < rings; r++)
+        for(int s = 0; s < segments; s++){
+            int a = r*segments+s+1, b = r*segments+(s+1)%segments+1;
+            fprintf(obj,"f %d %d %d %d\n",a,a+segments,b+segments,b);
+            int corners[2][3][2] = {{{r,s},{r+1,s},{r+1,s+1}},{{r,s},{r+1,s+1},{r,s+1}}};
+            for(auto & triangle : corners){
+                float facet[12] = {0};
+                for(int k = 0; k < 3; k++)
+                    position(triangle[k][0],triangle[k][1],facet+3+3*k);
+                uint16_t attributes = 0;
+                fwrite(facet,4,12,stl);
+                fwrite(&attributes,2,1,stl);
+            }
+        }
+    fclose(obj);
+    fclose(stl);
+
+    int triangles = 2*rings*segments;
+    for(int threads : {1,0}){
+        bench(threads?"load_obj 1 thread":"load_obj",0,0,0,triangles,triangles,[&]{
+            Mesh * mesh = load_obj(obj_path,false,threads);
+            sink = mesh?mesh->getTriangleNo():0;
+            delete mesh;
+        });
+    }
+    bench("load_stl",0,0,0,triangles,triangles,[&]{
+        Mesh * mesh = load_stl(stl_path,false);
+        sink = mesh?mesh->getVertexNo():0;
+        delete mesh;
+    });
+    bench("load_obj + edges",0,0,0,triangles,triangles,[&]{
+        Mesh * mesh = load_obj(obj_path);
+        sink = mesh?mesh->getEdgeNo():0;
+        delete mesh;
+    });
+
+    // The same model from a mesh file, loading it and then loading and transforming it once
+    // These are timed per load, since a load does not depend on the size
+    const char * mesh_path = "bench_model.amesh";
+    Mesh * model = load_obj(obj_path);
+    bool saved = model && save_mesh_file(model,mesh_path);
+    delete model;
+    if(saved){
+        bench("load_mesh_file",0,0,0,triangles,1,[&]{
+            Mesh * mesh = load_mesh_file(mesh_path);
+            sink = mesh?mesh->getBounds()[0]:0;
+            delete mesh;
+        });
+        bench("mesh_file+transform",0,0,0,triangles,1,[&]{
+            Mesh * mesh = load_mesh_file(mesh_path);
+            if(mesh){
+                mesh->transform(matrix_scale(2,2,2));
+                sink = mesh->getScreenX()[0];
+            }
+            delete mesh;
+        });
+    }
+    remove(obj_path);
+    remove(stl_path);
+    remove(mesh_path);
+
+}
+
+void bench_canvas(int width, int height, int aa, int count){
+    // The rasterization and the output on a canvas of the given size
+
+    Canvas * canvas = new Canvas(width,height);
+    canvas->getEmitter()->setOutput(-1); // Null sink
+    canvas->setAA(aa);
+    Color white(1,1,1), grey(0.5,0.5,0.5), black(0,0,0);
+
+    // Random primitives that mostly fall on the canvas
+    srand(1);
+    std::vector<int> coords(6*count);
+    for(int i = 0; i < 6*count; i++)
+        coords[i] = rand()%((i%2)?height:width);
+
+    bench("Line points",width,height,aa,count,count,[&]{
+        for(int i = 0; i < count; i++){
+            Line line(coords[6*i],coords[6*i+1],coords[6*i+2],coords[6*i+3]);
+            for(LinePoint p : line)
+                sink += p.x+p.y;
+        }
+    });
+
+    bench("Line runs",width,height,aa,count,count,[&]{
+        for(int i = 0; i < count; i++){
+            Line line(coords[6*i],coords[6*i+1],coords[6*i+2],coords[6*i+3]);
+            line.runs([&](long long x0, long long x1, long long y){ sink += x1-x0+y; });
+        }
+    });
+
+    bench("Canvas::draw_line",width,height,aa,count,count,[&]{
+        for(int i = 0; i < count; i++)
+            canvas->draw_line(coords[6*i],coords[6*i+1],coords[6*i+2],coords[6*i+3],false,white);
+        canvas->flush();
+    });
+
+    bench("draw_circle",width,height,aa,count,count,[&]{
+        for(int i = 0; i < count; i++)
+            canvas->draw_circle(coords[6*i],coords[6*i+1],1+coords[6*i+2]%(height/4+1),white);
+    });
+
+    bench("fill_rect",width,height,aa,count,count,[&]{
+        for(int i = 0; i < count; i++)
+            canvas->fill_rect(coords[6*i],coords[6*i+1],coords[6*i+2],coords[6*i+3],(i%2)?white:grey);
+    });
+
+    bench("fill_circle",width,height,aa,count,count,[&]{
+        for(int i = 0; i < count; i++)
+            canvas->fill_circle(coords[6*i],coords[6*i+1],1+coords[6*i+2]%(height/4+1),(i%2)?white:grey);
+    });
+
+    // Concave polygons, an arrow made of seven points around each random point
+    bench("fill_polygon",width,height,aa,count,count,[&]{
+        for(int i = 0; i < count; i++){
+            double x = coords[6*i], y = coords[6*i+1], s = 1+coords[6*i+2]%(height/4+1);
+            double arrow[14] = {x-s,y-s/3,x,y-s/3,x,y-s,x+s,y,x,y+s,x,y+s/3,x-s,y+s/3};
+            canvas->fill_polygon(arrow,7,(i%2)?white:grey);
+        }
+    });
+
+    bench("draw_triangle",width,height,aa,count,count,[&]{
+        for(int i = 0; i < count; i++)
+            canvas->draw_triangle(coords[6*i],coords[6*i+1],coords[6*i+2],coords[6*i+3],coords[6*i+4],coords[6*i+5],white);
+        canvas->flush();
+    });
+
+    bench("fill_triangle",width,height,aa,count,count,[&]{
+        for(int i = 0; i < count; i++)
+            canvas->fill_triangle(coords[6*i],coords[6*i+1],(i%7)*0.1,coords[6*i+2],coords[6*i+3],(i%5)*0.1,
+                coords[6*i+4],coords[6*i+5],(i%3)*0.1,(i%2)?white:grey);
+        canvas->flush();
+    });
+
+    bench("draw_clear",width,height,aa,0,1,[&]{
+        canvas->draw_clear(black);
+    });
+
+    // A full frame, every pixel gets sent
+    canvas->draw_clear(black);
+    for(int i = 0; i < count; i++)
+        canvas->draw_line(coords[6*i],coords[6*i+1],coords[6*i+2],coords[6*i+3],false,white);
+    bench("render_full",width,height,aa,count,1,[&]{
+        canvas->redraw();
+        canvas->render();
+    },canvas);
+
+    // The demo scene, only what changed gets sent
+    // It runs again while being recorded (to a null file), to see what the recording costs
+    double w = 0;
+    auto scene = [&]{
+        Point c1(0,0,0), c2(10,10,10), viewpoint(80*cos(w),80*sin(w),30), viewdir(-cos(w),-sin(w),-0.9);
+        Mesh * cube = mesh_cube(&c1,&c2);
+        Transform * camera = transform_view_per(&viewpoint,&viewdir,100.0);
+        camera->add(matrix_translate(width/2,height/6,0));
+        cube->transform(camera);
+        canvas->draw_clear(black);
+        canvas->draw_mesh(cube,white);
+        canvas->render();
+        delete cube;
+        delete camera;
+        w += 0.01;
+    };
+    bench("render_scene",width,height,aa,1,1,scene,canvas);
+    Recorder * recorder = canvas->record("/dev/null");
+    bench("render_recorded",width,height,aa,1,1,scene,canvas);
+    canvas->setRecorder(nullptr);
+    delete recorder;
+
+    // Again with every letter in its nearest color of the 256 color palette
+    canvas->setColorMode(COLOR_256);
+    bench("render_colors",width,height,aa,1,1,scene,canvas);
+    canvas->setColorMode(COLOR_NONE);
+
+    // Many cubes all around a camera in the middle, most of them out of the view
+    int cubes = count;
+    Mesh ** meshes = new Mesh*[cubes];
+    for(int i = 0; i < cubes; i++){
+        Point p1(rand()%200-100,rand()%200-100,rand()%60-30);
+        Point p2(p1.getX()+4,p1.getY()+4,p1.getZ()+4);
+        meshes[i] = mesh_cube(&p1,&p2);
+    }
+    Point center(0,0,0), forward(1,0.2,-0.1);
+    Transform * view = transform_view_per(&center,&forward,100.0);
+    view->add(matrix_translate(width/2,height/2,0));
+    for(int mode : {(int)CULL_NONE,CULL_FRUSTUM|CULL_BACKFACE}){
+        canvas->setCulling(mode);
+        bench(mode?"draw_cubes_culled":"draw_cubes",width,height,aa,count,cubes,[&]{
+            canvas->draw_clear(black);
+            for(int i = 0; i < cubes; i++)
+                canvas->fill_mesh(meshes[i],view,white);
+            canvas->flush();
+        });
+    }
+
+    // The same cubes as instances of a single mesh
+    Point corner1(0,0,0), corner2(4,4,4);
+    Mesh * cube = mesh_cube(&corner1,&corner2);
+    std::vector<Mat3x4> models(cubes);
+    for(int i = 0; i < cubes; i++)
+        models[i] = Mat3x4(matrix_translate(meshes[i]->getX()[0],meshes[i]->getY()[0],meshes[i]->getZ()[0]));
+    bench("draw_cubes_instanced",width,height,aa,count,cubes,[&]{
+        canvas->draw_clear(black);
+        canvas->fill_instances(cube,view,models.data(),cubes,white);
+        canvas->flush();
+    });
+    delete cube;
+
+    for(int i = 0; i < cubes; i++)
+        delete meshes[i];
+    delete[] meshes;
+    delete view;
+
+    delete canvas;
+
+}
+
+void write_json(FILE * out){
+    // Writes all the results as a JSON array
+    fprintf(out,"[\n");
+    for(size_t i = 0; i < results.size(); i++){
+        Result & r = results[i];
+        fprintf(out,"  {\"name\": \"%s\", \"width\": %d, \"height\": %d, \"aa\": %d, \"count\": %d, "
+            "\"iterations\": %ld, \"ns_per_op\": %.3f, \"allocs_per_op\": %.4f, \"bytes_per_op\": %.2f}%s\n",
+            r.name.c_str(),r.width,r.height,r.aa,r.count,r.iterations,r.ns_per_op,r.allocs_per_op,r.bytes_per_op,
+            (i+1 < results.size())?",":"");
+    }
+    fprintf(out,"]\n");
+}
+
+int main(int argc, char ** argv){
+
+    bench_math();
+    bench_loader();
+
+    int sizes[][2] = {{80,24},{100,60},{400,200}};
+    for(auto & size : sizes)
+        for(int aa : {AA_NONE,AA_2X2,AA_4X4,AA_ROTATED})
+            for(int count : {100,1000})
+                bench_canvas(size[0],size[1],aa,count);
+
+    // Write the results
+    FILE * out = (argc > 1)?fopen(argv[1],"w"):stdout;
+    if(!out){
+        fprintf(stderr,"Could not open %s\n",argv[1]);
+        return 1;
+    }
+    write_json(out);
+    if(out != stdout) fclose(out);
+
+}
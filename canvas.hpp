@@ -1,185 +1,296 @@
 #include <cstdio>
-#define clear() printf("\033[H\033[J")
-#define gotoxy(x,y) printf("\033[%d;%dH", (y), (x))
 #include <cmath>
+#include <cstring>
 #include <algorithm>
+#include <vector>
 #include "space.hpp"
+#include "mesh.hpp"
+#include "emitter.hpp"
+#include "threadpool.hpp"
+#include "glyphs.hpp"
+#include "recorder.hpp"
+#include "color.hpp"
 
-class Color{
-    // This class will represent color in various color schemes.
-    // It will be stored internally in the rgb format
-    // Later, matrices will be used for everything, but not for now
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-    private:
-
-        double * rgb;
-
-    public:
+#ifndef _canvass
+#define _canvass
 
-        Color(double r, double g, double b){
-            
-            // Create the array and store the rgb values
-            rgb = new double[3];
-            rgb[0] = (r>1)?1:r;
-            rgb[1] = (g>1)?1:g;
-            rgb[2] = (b>1)?1:b;
+// Drawing helper functions
+struct LinePoint{
+    long long x, y;
+};
 
-        }
+class Line{
+    // This walks the points of a line with bresenham, one step at a time, without allocating anything.
+    // Use it with range-for (for(LinePoint p : line)), with a callback for every point (each),
+    // or with a callback for every horizontal run of points (runs), so a whole run can be written at once.
+    // Any step can be reached directly, so clip() skips the steps outside an area without walking them.
 
-        ~Color(){
+    private:
 
-            // Delete the array alloted for the values
-            delete[] rgb;
+        long long start[2]; // The first point
+        long long length, rise; // Steps along the longer axis (the major one), and along the other one
+        long long half; // The walk starts with the error at -half, never at zero so a flat line never turns
+        int dir[2]; // Which way each axis goes
+        int major, minor; // 0 for x, 1 for y
+        long long first, last; // The steps that are walked
 
+        static long long floor_div(__int128 a, long long b){
+            // Division that rounds down for negative numbers too (b is positive)
+            return (long long)((a >= 0)?a/b:-((-a+b-1)/b));
         }
 
-        double * getRGB(){
-            // Returns the rgb array
-            return rgb;
+    public:
 
+        Line(long long x1, long long y1, long long x2, long long y2){
+            start[0] = x1;
+            start[1] = y1;
+            major = (llabs(y2-y1) > llabs(x2-x1))?1:0;
+            minor = 1-major;
+            long long end[2] = {x2,y2};
+            length = llabs(end[major]-start[major]);
+            rise = llabs(end[minor]-start[minor]);
+            dir[0] = (x2 < x1)?-1:1;
+            dir[1] = (y2 < y1)?-1:1;
+            half = std::max(length>>1,1LL);
+            first = 0;
+            last = length;
         }
 
-        // Those return basic colors individually
-        double getRed(){
-            return rgb[0];
-        }
-        double getGreen(){
-            return rgb[1];
-        }
-        double getBlue(){
-            return rgb[2];
+        // How many times the minor axis has moved after i steps, which gives the error term at any step
+        // The products can pass 64 bits for lines far off the surface, so they are done in 128
+        long long steps(long long i) const{
+            if(i == 0 || length == 0) return 0;
+            return floor_div((__int128)i*rise-half,length)+1;
         }
 
-        // Overload the operator for easier access
-        double operator[](int index){
-            return rgb[index];
+        // The point at step i
+        LinePoint at(long long i) const{
+            long long p[2];
+            p[major] = start[major]+dir[major]*i;
+            p[minor] = start[minor]+dir[minor]*steps(i);
+            LinePoint point = {p[0],p[1]};
+            return point;
         }
 
-        // Those return the HSV values for the specific color
-        double getValue(){
-            // Value is derived by the mean of colors
-            return (rgb[0]+rgb[1]+rgb[2])/3.0;
+        // How many points will be walked
+        long long getCount() const{
+            return (first <= last)?last-first+1:0;
         }
 
-        // This is for ascii matching
-        char getLetter(){
+        bool clip(long long x0, long long y0, long long x1, long long y1){
+            // Keeps only the points inside the area (the bounds are inside too), false if none are left
 
-            int pallete_no = 4;
-            char pallete[pallete_no];
-            pallete[0] = ' ';
-            pallete[1] = 'o';
-            pallete[2] = '0';
-            pallete[3] = '@';
+            long long lo[2] = {x0,y0}, hi[2] = {x1,y1};
 
-            // Pick different letter according to value
-            double v = getValue();
-            v*= pallete_no-1;
-            return pallete[(int)v];
-            
+            // The steps where the major axis is inside
+            long long a, z;
+            if(dir[major] > 0){
+                a = lo[major]-start[major];
+                z = hi[major]-start[major];
+            }else{
+                a = start[major]-hi[major];
+                z = start[major]-lo[major];
+            }
+            first = std::max(first,a);
+            last = std::min(last,z);
+            if(first > last) return false;
+
+            // The minor axis only moves one way, so the steps where it is inside can be found by bisection
+            long long klo, khi;
+            if(dir[minor] > 0){
+                klo = lo[minor]-start[minor];
+                khi = hi[minor]-start[minor];
+            }else{
+                klo = start[minor]-hi[minor];
+                khi = start[minor]-lo[minor];
+            }
+            if(length == 0){
+                if(klo > 0 || khi < 0) last = first-1;
+                return first <= last;
+            }
+            a = first;
+            z = last+1;
+            while(a < z){ // First step with steps(i) >= klo
+                long long mid = a+(z-a)/2;
+                if(steps(mid) >= klo) z = mid;
+                else a = mid+1;
+            }
+            first = a;
+            a = first-1;
+            z = last;
+            while(a < z){ // Last step with steps(i) <= khi
+                long long mid = a+(z-a+1)/2;
+                if(steps(mid) <= khi) a = mid;
+                else z = mid-1;
+            }
+            last = a;
+            return first <= last;
 
         }
 
-        // Function for copying another color exactly
-        void paste(Color * other){
-            for(int i = 0; i < 3; i++)
-                rgb[i] = other->rgb[i];
-        }
+        class iterator{
+            // Walks the line from a step, keeping the error term as it goes
 
-        //Function to determine if two colors are the same
-        bool equals(Color * other){
-            return (rgb[0] == other->rgb[0] || rgb[1] == other->rgb[1] || rgb[2] == other->rgb[2]);
-        }
+            private:
 
-};
+                const Line * line;
+                long long i, e;
+                long long p[2];
 
-class Pixel{
-    // This class will hold information on a specific pixel.
-    // That is color information, depth information, and various things that 
-    // have not yet been implemented.
+            public:
 
-    private:
+                iterator(const Line * l, long long step) : line(l), i(step){
+                    long long k = l->steps(step);
+                    e = (long long)(-l->half+(__int128)step*l->rise-(__int128)k*l->length);
+                    p[l->major] = l->start[l->major]+l->dir[l->major]*step;
+                    p[l->minor] = l->start[l->minor]+l->dir[l->minor]*k;
+                }
 
-        Color * color;
-        double z; // Used for z-buffering
+                LinePoint operator*() const{
+                    LinePoint point = {p[0],p[1]};
+                    return point;
+                }
 
-    public:
+                iterator & operator++(){
+                    p[line->major] += line->dir[line->major];
+                    e += line->rise;
+                    if(e >= 0){
+                        p[line->minor] += line->dir[line->minor];
+                        e -= line->length;
+                    }
+                    i++;
+                    return *this;
+                }
 
-        Pixel(){
-            // Creates an empty black pixel
-            color = new Color(0,0,0);
+                bool operator!=(const iterator & other) const{
+                    return i != other.i;
+                }
 
-        }
+                // True if the next step moves the minor axis
+                bool turns() const{
+                    return e+line->rise >= 0;
+                }
 
-        ~Pixel(){
-            // Delete the color before you go
-            delete color;
+        };
+
+        iterator begin() const{
+            return iterator(this,first);
         }
 
-        // Getter for the color
-        Color * getColor(){
-            return color;
+        iterator end() const{
+            return iterator(this,std::max(first,last+1));
         }
 
-        // Getters/setter for z value
-        double getZ(){
-            return z;
+        template <typename F>
+        void each(F f) const{
+            // Calls f(x,y) for every point
+            for(LinePoint p : *this)
+                f(p.x,p.y);
         }
 
-        void setZ(double new_z){
-            z = new_z;
+        template <typename F>
+        void runs(F f) const{
+            // Calls f(x0,x1,y) for every horizontal run of points, x0 <= x1
+            // A line that is mostly horizontal has long runs, a mostly vertical one has a run per point
+
+            if(first > last) return;
+            long long from = 0;
+            bool open = false;
+            for(iterator it = begin(), stop = end(); it != stop; ++it){
+                LinePoint p = *it;
+                if(!open){
+                    from = p.x;
+                    open = true;
+                }
+                // The run ends where y changes, which is every step for a vertical line
+                if(major == 1 || it.turns()){
+                    f(std::min(from,p.x),std::max(from,p.x),p.y);
+                    open = false;
+                }
+            }
+            if(open){
+                LinePoint p = at(last);
+                f(std::min(from,p.x),std::max(from,p.x),p.y);
+            }
+
         }
-    
 
 };
 
-// Drawing helper functions
-int * bresenham(int lengthx,int heighty,int xstart = 0, int ystart = 0, int order = 0){
-    // This will perform bresenham and return the points on the line [x1, y1, x2, y2, ...]
-    // Assumes that abs(lengthx) is greater than abs(lengthy)
-    
-    // Find the signs for correct iteration
-    int signx = 1-2*(lengthx<0);
-    int signy = 1-2*(heighty<0);
-    lengthx *= signx;
-    heighty *= signy;
-
-    int * res = new int[2*(lengthx+1)];
-    int e = -(lengthx>>1);
-    int xx = xstart, yy = ystart;
-    for(int i = 0; i <= lengthx; i++){
-        res[2*i+order] = xx;
-        res[2*i+1-order] = yy;
-        xx+=signx;
-        e += heighty;
-        if (e >= 0){
-            yy+=signy;
-            e -= lengthx;
-        }
-    }
 
-    return res;
+struct Rect{
+    // An area of the surface in subpixels, used to clip the drawing
+    // The starting coords are inside, the ending ones are not
+    int x0, y0, x1, y1;
+};
 
-}
+struct PolygonEdge{
+    // An edge of a polygon being filled, in subpixels
+    // It crosses the centers of the rows from first to last, x is where it crosses the current one
+    int first, last;
+    double x, step; // step is how much x moves from one row to the next
+};
 
-int * bresenham_line(int x1, int y1, int x2, int y2, int &length){
-    // This specific function will produce all the points on the
-    // specified line using the bresenham method.
-    // The points are then saved on an array in the form [x1,y1,x2,y2,x3,y3 ...]
-    // This function is very useful not only for drawing lines, but figuring out points
-    // for more complex shapes (e.g. triangles)
-
-    // Calculate the initial variables to find which case applies
-    int dx = x2-x1, dy = y2-y1;
-
-    // Check which of the two you need to iterate
-    if (abs(dx) >= abs(dy)){
-        // Iterating x
-        length = abs(dx)+1;
-        return bresenham(dx,dy,x1,y1);
-    }else{
-        // Iterating y
-        length = abs(dy)+1;
-        return bresenham(dy,dx,y1,x1,1);
+struct Primitive{
+    // A line or triangle that waits in the tile bins to be rasterized
+    // A line keeps its ends in v[0..3], a triangle keeps x,y,z for each point in v[0..8]
+    bool triangle;
+    bool use_aa;
+    unsigned char r, g, b;
+    double v[9];
+};
+
+// Antialaising modes for Canvas::setAA
+// The grids split every pixel into that many subpixels. The rotated grid has the 2x2 subpixels of AA_2X2 (and costs
+// the same), but the triangles are sampled off their centers, one sample in every quarter of a row and column,
+// so edges near vertical or horizontal get 5 levels of coverage instead of 3. The other shapes fill it like AA_2X2.
+enum Antialias { AA_NONE = 1, AA_2X2 = 2, AA_3X3 = 3, AA_4X4 = 4, AA_ROTATED = 5 };
+
+// Culling modes for Canvas::setCulling, can be combined with |
+// Frustum culling skips meshes whose box is outside the view, back-face culling skips the triangles
+// (and the wireframe edges between them) that face away from the camera, which only suits closed meshes
+enum Culling { CULL_NONE = 0, CULL_FRUSTUM = 1, CULL_BACKFACE = 2 };
+
+// Where a mesh is compared to the view, VIEW_VISIBLE, VIEW_IN_FRONT and VIEW_INSIDE can be combined
+enum View { VIEW_OUTSIDE = 0, VIEW_VISIBLE = 1, VIEW_IN_FRONT = 2, VIEW_INSIDE = 4 };
+
+struct CullStats{
+    // What the culling removed since the counters were reset
+    long meshes, meshes_culled; // Meshes tested against the view, and the ones outside it
+    long triangles, triangles_culled; // Triangles tested for facing, and the ones facing away
+    long edges, edges_culled; // Wireframe edges tested, and the ones with only faces facing away
+};
+
+// Sums a number of rows of bytes into 16 bit counters, 16 bytes at a time when SSE2 is there
+// rows must be at most 257 so the counters can't overflow
+inline void sum_rows(const unsigned char * src, int stride, int rows, int n, unsigned short * sum){
+
+    int i = 0;
+
+#if defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+    for(; i+16 <= n; i += 16){
+        __m128i lo = zero, hi = zero;
+        for(int r = 0; r < rows; r++){
+            __m128i v = _mm_loadu_si128((const __m128i *)(src+r*stride+i));
+            lo = _mm_add_epi16(lo,_mm_unpacklo_epi8(v,zero));
+            hi = _mm_add_epi16(hi,_mm_unpackhi_epi8(v,zero));
+        }
+        _mm_storeu_si128((__m128i *)(sum+i),lo);
+        _mm_storeu_si128((__m128i *)(sum+i+8),hi);
+    }
+#endif
+
+    // The rest one at a time
+    for(; i < n; i++){
+        int total = 0;
+        for(int r = 0; r < rows; r++)
+            total += src[r*stride+i];
+        sum[i] = total;
     }
 
 }
@@ -193,63 +304,787 @@ class Canvas{
     private:
 
         int width, height;
-        Pixel *** surf; // Stands for surface
-        bool ** buffer; // Buffer to check which pixels have been drawn
+        int sw, sh; // Dimensions of the surface in subpixels (width*aa_factor, height*aa_factor)
+
+        // The surface is a single contiguous block, split into structure-of-arrays planes.
+        // Every plane is row-major, so subpixel (x,y) lives at index y*sw+x in all of them.
+        float * surf; // Stands for surface, owns the whole block
+        float * depth; // Depth plane used for z-buffering
+        unsigned char * red, * green, * blue; // Color planes, 0-255 per channel
         bool framerendered = false;
 
+        // Variables for finding what changed since the last frame
+        // Every row of pixels is split in segments, one for each column of tiles (see below),
+        // and each segment keeps the span of pixels drawn since the last render.
+        // The tiles own their segments, so threads never touch the same span.
+        int * span_lo, * span_hi; // First and last drawn pixel of every segment, empty if lo > hi
+        char * emitted; // The letters that are on the terminal (row-major, one per pixel)
+        unsigned char * emitted_tints; // The palette colors of the letters that are on the terminal
+        unsigned char * resolved; // The resolved red, green and blue planes of the pixels (row-major, owns the shading block)
+        unsigned char * brightness; // The resolved brightness of every pixel (0-255, row-major)
+        char * letters; // The letters the brightness was last shaded into (row-major)
+        unsigned char * tints; // The palette color of every letter, when the output has colors (row-major)
+        const Palette * palette = nullptr; // The colors of the output, nullptr for letters only (see setColorMode)
+        int color_mode = COLOR_NONE;
+        int tint = -1; // The letter color the terminal is set to, -1 for its own
+        bool * shaded; // Which rows were shaded again since the last render to the terminal
+        GlyphRamp * glyphs; // Turns the brightness into letters
+        int dither = DITHER_NONE; // How the brightness is spread between the letters
+        bool reshade = false; // Set when every row has to be shaded again, e.g. for a new ramp
+        FrameEmitter * emitter; // Collects the bytes of every frame before they go to the terminal
+        Recorder * recorder = nullptr; // Gets a copy of every frame, if set
+        FrameEmitter * keyframe = nullptr; // Builds the full frames for the recorder
+
+        // Variables for multi-threaded rasterization
+        // When there is more than one thread, lines and triangles are sorted into tiles of the
+        // surface and every tile is rasterized by one thread, in the order they were drawn.
+        static const int tile_size = 16; // In pixels, so a tile always holds whole pixels
+        int threads = 1;
+        ThreadPool * pool = nullptr;
+        int tiles_x, tiles_y; // How many tiles fit the surface
+        std::vector<Primitive> pending; // The primitives waiting to be rasterized
+        std::vector<int> * bins; // For every tile, the primitives that touch it
+
+        // Variables for culling
+        int culling = CULL_FRUSTUM;
+        double near_plane = 0.1; // Closest distance from the camera that can be seen
+        double projection_front = -1; // The sign of w in front of the camera, for matrices with a projection
+        CullStats stats = {};
+        std::vector<char> facing; // Scratch for the facing of every triangle of a mesh
+        std::vector<Vec4> clip_space; // Scratch for the vertices of a mesh before the divide
+
+        // Scratch for the filled shapes, kept so filling does not allocate every time
+        std::vector<PolygonEdge> edge_table; // All the edges of a polygon, by their first row
+        std::vector<PolygonEdge> active_edges; // The edges that cross the current row
+
         // Variables for antialaising
-        int aa_factor = 1;
-        Color * tempcolor;
-        static Color * drawcolor;
-
-
-        // Private drawing functions to help with the public ones
-        void draw_point_8(int xx, int yy, int xo, int yo, Color * c){
-            // Draws around (xo, yo) with 8-symmetry
-            draw_point_aa(xo+xx,yo+yy,c);
-            draw_point_aa(xo-xx,yo+yy,c);
-            draw_point_aa(xo+xx,yo-yy,c);
-            draw_point_aa(xo-xx,yo-yy,c);
-            draw_point_aa(xo+yy,yo+xx,c);
-            draw_point_aa(xo-yy,yo+xx,c);
-            draw_point_aa(xo+yy,yo-xx,c);
-            draw_point_aa(xo-yy,yo-xx,c);
-        }
-
-        // Draws a point with subvalues for the color on the sides to achieve anti-alising
-        // This is only used by the draw methods and not by users
-        void draw_point_aa(int x, int y, Color * c){
-
-            // New draw point aa draws a whole pixel, offseted
-            for(int i = 0; i < aa_factor; i++){
-                for(int j = 0; j < aa_factor; j++){
-                    draw_point(x+i,y+j,c);
+        int aa_mode = AA_NONE;
+        int aa_factor = 1; // Subpixels per pixel along each axis
+        unsigned long long aa_inverse = 1ULL<<32; // 2^32/aa_factor rounded up, see pixel_of
+        unsigned short * row_sums; // Scratch for resolving, the subpixel columns of a span summed over a pixel row
+        unsigned char * divide; // Rounded average for every possible sum of the samples of a pixel
+        static Color drawcolor;
+
+
+        // The pixel a subpixel coord falls in, a multiply instead of dividing by aa_factor
+        // It is exact for every coord on the surface (up to 2^28)
+        int pixel_of(int s){
+            return (int)(((unsigned long long)s*aa_inverse)>>32);
+        }
+
+        // Writes a subpixel of the surface by its plane index and adds its pixel to the drawn span
+        // Whether the pixel really changed is only decided when rendering
+        void plot(int index, int x, int y, unsigned char r, unsigned char g, unsigned char b){
+            red[index] = r;
+            green[index] = g;
+            blue[index] = b;
+            int cx = pixel_of(x), segment = pixel_of(y)*tiles_x+cx/tile_size;
+            if(cx < span_lo[segment]) span_lo[segment] = cx;
+            if(cx > span_hi[segment]) span_hi[segment] = cx;
+        }
+
+        // Writes n subpixels from a plane index at once, the drawn spans are left to the caller
+        void plot_run(int index, int n, unsigned char r, unsigned char g, unsigned char b){
+            if(n < 8){ // Short runs (most of the points of a circle) are not worth a call
+                for(int i = index; i < index+n; i++){
+                    red[i] = r;
+                    green[i] = g;
+                    blue[i] = b;
+                }
+                return;
+            }
+            std::fill(red+index,red+index+n,r);
+            std::fill(green+index,green+index+n,g);
+            std::fill(blue+index,blue+index+n,b);
+        }
+
+        // Adds the pixels from cx0 to cx1 of row cy to the drawn spans, segment by segment
+        void mark_span(int cy, int cx0, int cx1){
+            int t0 = cx0/tile_size, t1 = cx1/tile_size;
+            for(int t = t0; t <= t1; t++){
+                int segment = cy*tiles_x+t;
+                int lo = (t == t0)?cx0:t*tile_size, hi = (t == t1)?cx1:(t+1)*tile_size-1;
+                if(lo < span_lo[segment]) span_lo[segment] = lo;
+                if(hi > span_hi[segment]) span_hi[segment] = hi;
+            }
+        }
+
+        // Sets the spans of every segment, to cover everything or nothing
+        void reset_spans(bool all){
+            for(int y = 0; y < height; y++){
+                for(int t = 0; t < tiles_x; t++){
+                    span_lo[y*tiles_x+t] = all?t*tile_size:width;
+                    span_hi[y*tiles_x+t] = all?std::min((t+1)*tile_size,width)-1:-1;
+                }
+            }
+        }
+
+        // Resolves the pixels x0 to x1 of row y from their subpixels into the resolved planes and the brightness
+        // The subpixel rows are summed with SIMD first, then every pixel adds up its columns
+        void resolve_span(int y, int x0, int x1){
+
+            const unsigned char * planes[3] = {red,green,blue};
+            int n = x1-x0+1, f = aa_factor;
+
+            for(int c = 0; c < 3; c++){
+                const unsigned char * plane = planes[c];
+                unsigned char * out = resolved+c*width*height+y*width;
+
+                if(f == 1){
+                    memcpy(out+x0,plane+y*sw+x0,n);
+                }else{
+                    sum_rows(plane+f*y*sw+f*x0,sw,f,n*f,row_sums);
+                    for(int i = 0; i < n; i++){
+                        int total = 0;
+                        for(int k = 0; k < f; k++)
+                            total += row_sums[i*f+k];
+                        out[x0+i] = divide[total];
+                    }
+                }
+            }
+
+            // The brightness is the mean of the channels, rounded down so the default ramp gives
+            // the letters of Color::getLetter (floor(3*v/255) of floor(sum/3) is floor(sum/255))
+            const unsigned char * r = resolved+y*width, * g = r+width*height, * b = g+width*height;
+            for(int x = x0; x <= x1; x++)
+                brightness[y*width+x] = (unsigned char)((r[x]+g[x]+b[x])/3);
+
+        }
+
+        double front_sign(const Mat4 & m){
+            // The sign that makes w positive in front of the camera
+            // Without a projection (a last row of 0 0 0 c) w is the constant c everywhere, so it's the sign of c.
+            // With one, the side in front is up to the projection and set by setProjectionFront.
+            if(m.m[3][0] == 0 && m.m[3][1] == 0 && m.m[3][2] == 0) return (m.m[3][3] > 0)?1.0:-1.0;
+            return projection_front;
+        }
+
+        static double det3(const Mat4 & m, int r0, int r1, int r2){
+            // The determinant of the first three columns of three rows of a matrix
+            return m.m[r0][0]*(m.m[r1][1]*m.m[r2][2]-m.m[r1][2]*m.m[r2][1])-
+                m.m[r0][1]*(m.m[r1][0]*m.m[r2][2]-m.m[r1][2]*m.m[r2][0])+
+                m.m[r0][2]*(m.m[r1][0]*m.m[r2][1]-m.m[r1][1]*m.m[r2][0]);
+        }
+
+        double winding(const Mat4 & m){
+            // The sign of the area on the screen of a triangle that faces the camera (counter-clockwise from outside)
+            // Without a projection the view is along -z, and a matrix that mirrors (negative determinant) turns the
+            // triangles over. With one, the x, y and w rows give the volume between the camera and the triangle,
+            // which is negative when the camera is on its outside, so the sign is the opposite of their determinant.
+            double s = front_sign(m);
+            if(m.m[3][0] == 0 && m.m[3][1] == 0 && m.m[3][2] == 0) return (det3(m,0,1,2) < 0)?-1.0:1.0;
+            return (s*det3(m,0,1,3) > 0)?-1.0:1.0;
+        }
+
+        static int to_pixel(double v){
+            // Rounds a coordinate down to a pixel, far away ones are kept far away without overflowing
+            if(!(v > -1e9)) return -1000000000;
+            if(v > 1e9) return 1000000000;
+            return (int)v;
+        }
+
+        int clip_near(const Vec4 * in, int n, Vec4 * out){
+            // Clips a polygon to the near plane with Sutherland-Hodgman, the points are in clip space (before the divide)
+            // with w positive in front of the camera. out needs space for n+1 points, returns how many there are
+
+            int count = 0;
+            for(int i = 0; i < n; i++){
+                const Vec4 & a = in[i], & b = in[(i+1)%n];
+                double da = a.w-near_plane, db = b.w-near_plane;
+                if(da >= 0) out[count++] = a;
+                if((da >= 0) != (db >= 0)){
+                    double t = da/(da-db);
+                    out[count++] = Vec4(a.x+(b.x-a.x)*t,a.y+(b.y-a.y)*t,a.z+(b.z-a.z)*t,near_plane);
+                }
+            }
+            return count;
+
+        }
+
+        void fill_clipped(const Vec4 & p1, const Vec4 & p2, const Vec4 & p3, Color c){
+            // Fills a triangle given in clip space, after clipping it to the near plane
+            // What is left is a triangle or a quad, which is split into triangles around its first point
+
+            Vec4 in[3] = {p1,p2,p3}, out[4];
+            int n = clip_near(in,3,out);
+            for(int k = 0; k < n; k++)
+                out[k] = Vec4(out[k].x/out[k].w,out[k].y/out[k].w,out[k].z/out[k].w,1.0);
+            for(int k = 1; k+1 < n; k++)
+                fill_triangle(out[0].x,out[0].y,out[0].z,out[k].x,out[k].y,out[k].z,out[k+1].x,out[k+1].y,out[k+1].z,c);
+
+        }
+
+        void draw_clipped(const Vec4 & p1, const Vec4 & p2, Color c){
+            // Draws a line given in clip space, after clipping it to the near plane
+
+            Vec4 a = p1, b = p2;
+            double da = a.w-near_plane, db = b.w-near_plane;
+            if(da < 0 && db < 0) return;
+            if(da < 0 || db < 0){
+                double t = da/(da-db);
+                Vec4 cut(a.x+(b.x-a.x)*t,a.y+(b.y-a.y)*t,a.z+(b.z-a.z)*t,near_plane);
+                if(da < 0) a = cut;
+                else b = cut;
+            }
+            draw_line(to_pixel(a.x/a.w),to_pixel(a.y/a.w),to_pixel(b.x/b.w),to_pixel(b.y/b.w),true,c);
+
+        }
+
+        const Vec4 * mesh_clip_space(Mesh * mesh){
+            // Transforms the vertices of a mesh to clip space (without the divide), with w positive in front
+
+            const Mat4 & m = mesh->getMatrix();
+            double s = front_sign(m);
+            const float * x = mesh->getX(), * y = mesh->getY(), * z = mesh->getZ();
+            clip_space.resize(mesh->getVertexNo());
+            for(int i = 0; i < mesh->getVertexNo(); i++){
+                Vec4 v = m*Vec4(x[i],y[i],z[i],1.0);
+                clip_space[i] = Vec4(s*v.x,s*v.y,s*v.z,s*v.w);
+            }
+            return clip_space.data();
+
+        }
+
+        bool triangle_clip_space(Triangle * tri, Vec4 * clip){
+            // Finds the points of a transformed triangle in clip space, with w positive in front
+            // Returns true if any of them is closer than the near plane, so the triangle needs clipping.
+            // The matrices the triangle went through tell if it was projected (see front_sign),
+            // so a triangle all behind the camera is clipped away instead of drawn mirrored.
+
+            double s = front_sign(tri->getMatrix());
+
+            bool near = false;
+            for(int k = 0; k < 3; k++){
+                const Vec4 & v = tri->getPoint(k)->getCoords();
+                clip[k] = Vec4(s*v.x,s*v.y,s*v.z,s*v.w);
+                if(clip[k].w < near_plane) near = true;
+            }
+            return near;
+
+        }
+
+        int classify(Mesh * mesh, const Mat4 & m){
+            // Finds where the box of the mesh is compared to the view, in clip space (before the divide)
+            // The box is outside if all its corners are outside the same plane of the view.
+
+            double s = front_sign(m);
+
+            // Count the corners outside every plane: the near plane, then the left, right, bottom and top sides
+            // The sides are a pixel wider than the canvas, for the points that round onto it
+            const float * b = mesh->getBounds();
+            int out[5] = {0,0,0,0,0};
+            for(int i = 0; i < 8; i++){
+                double px = b[(i&1)?3:0], py = b[(i&2)?4:1], pz = b[(i&4)?5:2];
+                double X = s*(m.m[0][0]*px+m.m[0][1]*py+m.m[0][2]*pz+m.m[0][3]);
+                double Y = s*(m.m[1][0]*px+m.m[1][1]*py+m.m[1][2]*pz+m.m[1][3]);
+                double W = s*(m.m[3][0]*px+m.m[3][1]*py+m.m[3][2]*pz+m.m[3][3]);
+                if(W < near_plane) out[0]++;
+                if(X < -W) out[1]++;
+                if(X > (width+1)*W) out[2]++;
+                if(Y < -W) out[3]++;
+                if(Y > (height+1)*W) out[4]++;
+            }
+
+            int view = VIEW_VISIBLE|VIEW_IN_FRONT|VIEW_INSIDE;
+            for(int k = 0; k < 5; k++){
+                if(out[k] == 8) return VIEW_OUTSIDE;
+                if(out[k] > 0) view &= (k == 0)?VIEW_VISIBLE:VIEW_VISIBLE|VIEW_IN_FRONT;
+            }
+            return view;
+
+        }
+
+        int cull(Mesh * mesh, const Mat4 & m){
+            // Tests a mesh against the view and counts it, returns VIEW_OUTSIDE only if it should be skipped
+            int view = classify(mesh,m);
+            stats.meshes++;
+            if(view != VIEW_OUTSIDE) return view;
+            if(culling&CULL_FRUSTUM){
+                stats.meshes_culled++;
+                return VIEW_OUTSIDE;
+            }
+            return VIEW_VISIBLE;
+        }
+
+        bool find_facing(Mesh * mesh, int view){
+            // Finds which triangles of a transformed mesh face the camera, false if back-face culling can't be done
+            // The triangles are counter-clockwise seen from outside, the matrix tells which way that is on the screen
+            // The facing is only known when the whole mesh is in front of the camera
+            // Every triangle is counted as tested here, for the wireframe as well as the filled mesh
+
+            if(!(culling&CULL_BACKFACE) || !(view&VIEW_IN_FRONT)) return false;
+
+            const float * sx = mesh->getScreenX();
+            const float * sy = mesh->getScreenY();
+            const int * tris = mesh->getTriangles();
+            int n = mesh->getTriangleNo();
+            float front = winding(mesh->getMatrix());
+            facing.resize(n);
+            for(int i = 0; i < n; i++){
+                int a = tris[3*i], b = tris[3*i+1], d = tris[3*i+2];
+                float area = (sx[b]-sx[a])*(sy[d]-sy[a])-(sy[b]-sy[a])*(sx[d]-sx[a]);
+                facing[i] = area*front > 0;
+                if(!facing[i]) stats.triangles_culled++;
+            }
+            stats.triangles += n;
+            return true;
+
+        }
+
+        void fill_culled(Mesh * mesh, int view, Color c){
+            // Fills the triangles of a transformed mesh, skipping the ones facing away
+
+            const float * sx = mesh->getScreenX();
+            const float * sy = mesh->getScreenY();
+            const float * sz = mesh->getScreenZ();
+            const int * tris = mesh->getTriangles();
+            bool backface = find_facing(mesh,view);
+            int n = mesh->getTriangleNo();
+
+            // If part of the mesh is behind the near plane, the triangles that cross it are clipped first
+            const Vec4 * clip = (view&VIEW_IN_FRONT)?nullptr:mesh_clip_space(mesh);
+            for(int i = 0; i < n; i++){
+                if(backface && !facing[i]) continue;
+                int a = tris[3*i], b = tris[3*i+1], d = tris[3*i+2];
+                if(clip && (clip[a].w < near_plane || clip[b].w < near_plane || clip[d].w < near_plane))
+                    fill_clipped(clip[a],clip[b],clip[d],c);
+                else
+                    fill_triangle(sx[a],sy[a],sz[a],sx[b],sy[b],sz[b],sx[d],sy[d],sz[d],c);
+            }
+
+        }
+
+        void draw_culled(Mesh * mesh, int view, Color c){
+            // Draws the wireframe of a transformed mesh, every edge is drawn once
+            // With back-face culling an edge is only drawn if one of its triangles faces the camera
+
+            const float * sx = mesh->getScreenX();
+            const float * sy = mesh->getScreenY();
+            const int * edges = mesh->getEdges();
+            const int * faces = mesh->getEdgeFaces();
+            bool backface = find_facing(mesh,view);
+
+            // If part of the mesh is behind the near plane, the edges that cross it are clipped first
+            const Vec4 * clip = (view&VIEW_IN_FRONT)?nullptr:mesh_clip_space(mesh);
+            for(int i = 0; i < mesh->getEdgeNo(); i++){
+                if(backface){
+                    stats.edges++;
+                    int f1 = faces[2*i], f2 = faces[2*i+1];
+                    if(!facing[f1] && (f2 < 0 || !facing[f2])){
+                        stats.edges_culled++;
+                        continue;
+                    }
                 }
+                int a = edges[2*i], b = edges[2*i+1];
+                if(clip && (clip[a].w < near_plane || clip[b].w < near_plane))
+                    draw_clipped(clip[a],clip[b],c);
+                else
+                    draw_line(to_pixel(sx[a]),to_pixel(sy[a]),to_pixel(sx[b]),to_pixel(sy[b]),true,c);
             }
 
-            /*
-            for(int i = -aa_factor/2; i < aa_factor/2+1; i++){
-                for(int j = -aa_factor/2; j < aa_factor/2+1; j++){
-                    delete tempcolor;
-                    double factor = aa_factor-abs(i)+abs(j);
-                    tempcolor = new Color(c->getRed()*factor,c->getGreen()*factor,c->getBlue()*factor);
-                    draw_point(x+i,y+j,tempcolor);
+        }
+
+        void instance(Mesh * mesh, const Mat4 & m, Color c, bool fill){
+            // Draws one instance of a mesh with its whole matrix, a mesh outside the view is not even transformed
+            int view = cull(mesh,m);
+            if(view == VIEW_OUTSIDE) return;
+            mesh->transform(m);
+            if(fill) fill_culled(mesh,view,c);
+            else draw_culled(mesh,view,c);
+        }
+
+        void emit_border(FrameEmitter * out){
+            // Draws the border around the view
+            for(int y = 0; y <= height+1; y++){
+                if(y == 0 || y == height+1){
+                    out->move(1,y+1);
+                    out->put('#',2*(width+2));
+                }else{
+                    out->move(1,y+1);
+                    out->put('#',2);
+                    out->move(2*width+3,y+1);
+                    out->put('#',2);
                 }
-            }*/
+            }
+        }
+
+        void emit_keyframe(){
+            // Gives the recorder a frame that clears the screen and draws everything that is on the terminal
+            if(!keyframe) keyframe = new FrameEmitter((width+2)*(height+2)*25+64,-1);
+            keyframe->forget_cursor();
+            keyframe->escape("\033[2J");
+            emit_border(keyframe);
+            int current = -1;
+            for(int y = height-1; y >= 0; y--){
+                keyframe->move(3,height-y+1);
+                for(int x = 0; x < width; x++){
+                    char letter = emitted[y*width+x]?emitted[y*width+x]:' ';
+                    if(palette && letter != ' ' && emitted_tints[y*width+x] != current){
+                        current = emitted_tints[y*width+x];
+                        keyframe->escape(palette->getEscape(current));
+                    }
+                    keyframe->put(letter,2);
+                }
+            }
+            if(current >= 0) keyframe->escape("\033[0m");
+            keyframe->move(0,height+3);
+            recorder->record(keyframe->getData(),keyframe->getSize(),true);
+            keyframe->flush();
+        }
+
+        void shade_frame(){
+            // Resolves what was drawn since the last frame and shades it into the letters plane
+
+            // Resolve the drawn spans, rows with nothing drawn are skipped
+            for(int y = 0; y < height; y++){
+                int * lo = span_lo+y*tiles_x, * hi = span_hi+y*tiles_x;
+                if(reshade) shaded[y] = true;
+                for(int t = 0; t < tiles_x; t++){
+                    if(lo[t] <= hi[t]){
+                        resolve_span(y,lo[t],hi[t]);
+                        shaded[y] = true;
+                    }
+                    lo[t] = width;
+                    hi[t] = -1;
+                }
+            }
+
+            // Shade the rows that changed in one pass, error diffusion carries between rows so it needs all of them
+            if(dither == DITHER_FLOYD){
+                glyphs->shade(brightness,letters,width,0,height,DITHER_FLOYD);
+                std::fill(shaded,shaded+height,true);
+            }else{
+                for(int y = 0; y < height; y++)
+                    if(shaded[y]) glyphs->shade(brightness+y*width,letters+y*width,width,y,1,dither);
+            }
+            reshade = false;
+
+            // Find the palette color of every letter that changed, blanks keep the one on the terminal
+            // since their color can't be seen (and so they never need it sent)
+            if(palette){
+                const unsigned char * r = resolved, * g = r+width*height, * b = g+width*height;
+                for(int y = 0; y < height; y++){
+                    if(!shaded[y]) continue;
+                    for(int i = y*width; i < (y+1)*width; i++)
+                        tints[i] = (letters[i] == ' ')?emitted_tints[i]:palette->nearest(color_bytes(r[i],g[i],b[i]));
+                }
+            }
+
+        }
+
+        void allocate_surface(){
+            // (Re)creates the surface and the buffers that depend on the antialaising, all black at zero depth
+
+            // Note that the surface should be size * aa_factor, to achieve the supersampling
+            sw = width*aa_factor;
+            sh = height*aa_factor;
+            int n = sw*sh;
+
+            // Allocate the surface once: the depth plane first, then the three color planes packed behind it
+            surf = new float[n+(3*n+sizeof(float)-1)/sizeof(float)];
+            depth = surf;
+            red = (unsigned char *)(surf+n);
+            green = red+n;
+            blue = green+n;
+
+            // Start with a black surface at zero depth
+            std::fill(depth,depth+n,0.0f);
+            std::fill(red,red+3*n,(unsigned char)0);
+
+            // The scratch for a whole row, and the averages for every sum up to all samples at 255
+            int samples = aa_factor*aa_factor;
+            row_sums = new unsigned short[sw];
+            divide = new unsigned char[255*samples+1];
+            for(int total = 0; total <= 255*samples; total++)
+                divide[total] = (unsigned char)((total+samples/2)/samples);
+
         }
 
         // This function will draw a subpixel on the surface (subpixels are the same as pixels when aa_factor is set to 1)
-        void draw_point(int x, int y,Color * c){
+        void draw_point(int x, int y,Color c){
             // Checks that the point is within the rectangle before drawing
-            if(x < 0 || x >= width*aa_factor || y < 0 || y >= height*aa_factor)
+            if(x < 0 || x >= sw || y < 0 || y >= sh)
                 return;
 
             // Draw the point in the specific color
-            Color * old = surf[x][y]->getColor();
-            if(!old->equals(c)){
-                old->paste(c);
-                buffer[x/aa_factor][y/aa_factor] = false;
+            plot(y*sw+x,x,y,c.r,c.g,c.b);
+        }
+
+        // Writes the aa_factor x aa_factor subpixels of a point at (x,y), the ones off the surface are skipped
+        void plot_block(int x, int y, unsigned char r, unsigned char g, unsigned char b){
+            for(int j = y; j < y+aa_factor; j++)
+                for(int i = x; i < x+aa_factor; i++)
+                    if(i >= 0 && i < sw && j >= 0 && j < sh)
+                        plot(j*sw+i,i,j,r,g,b);
+        }
+
+        // Fills the subpixels from (x0,y0) to (x1,y1) (all inside), a row at a time, only inside the clip area
+        void fill_area(long long x0, long long y0, long long x1, long long y1,
+            unsigned char r, unsigned char g, unsigned char b, const Rect & clip){
+            x0 = std::max(x0,(long long)clip.x0);
+            y0 = std::max(y0,(long long)clip.y0);
+            x1 = std::min(x1,(long long)clip.x1-1);
+            y1 = std::min(y1,(long long)clip.y1-1);
+            if(x0 > x1 || y0 > y1) return;
+            for(long long y = y0; y <= y1; y++)
+                plot_run(y*sw+x0,x1-x0+1,r,g,b);
+
+            // The spans are widened once for every pixel row the area touches
+            int cx0 = pixel_of(x0), cx1 = pixel_of(x1);
+            for(int cy = pixel_of(y0); cy <= pixel_of(y1); cy++)
+                mark_span(cy,cx0,cx1);
+        }
+
+        // The whole surface as a clip area
+        Rect full(){
+            Rect clip = {0,0,sw,sh};
+            return clip;
+        }
+
+        static long long floor_sqrt(__int128 n){
+            // The largest x with x*x <= n, for n >= 0
+            long long x = (long long)sqrtl((long double)n);
+            while(x > 0 && (__int128)x*x > n) x--;
+            while((__int128)(x+1)*(x+1) <= n) x++;
+            return x;
+        }
+
+        static long long circle_half_width(long long radius, long long d){
+            // The half width of the row at distance d (up to radius) from the center of the circle draw_circle walks
+            // Its error term makes the points (x,y) of the first octant the ones with x*x+y*y-y < radius*radius and
+            // y the largest there, so the widest point of a row is the largest x with x*x+d*d-max(x,d) < radius*radius
+            if(radius == 0) return 0;
+            __int128 q = (__int128)radius*radius-(__int128)d*d;
+
+            // Up to the diagonal, x*x < q+d
+            long long x = floor_sqrt(q+d-1);
+            if(x < d) return x;
+
+            // Past it, x*(x-1) < q
+            x = (floor_sqrt(4*q-3)+1)/2;
+            while((__int128)x*(x-1) >= q) x--;
+            while((__int128)(x+1)*x < q) x++;
+            return x;
+        }
+
+        static long long floor_div(long long a, long long b){
+            // Division that rounds down for negative numbers too (b is positive)
+            return (a >= 0)?a/b:-((-a+b-1)/b);
+        }
+
+        void raster_line(int x1,int y1, int x2, int y2, bool use_aa,
+            unsigned char r, unsigned char g, unsigned char b, const Rect & clip){
+            // Rasterizes a line with bresenham (see Line), only the part inside the clip area is visited
+            // The points are exactly the ones the whole line would have, the steps outside are just skipped
+
+            // Every point of the line becomes a block of subpixels
+            // With antialaising the points are subpixels themselves, without it they are whole pixels
+            int scale = use_aa?1:aa_factor;
+            long long unit = use_aa?aa_factor:1;
+
+            // The clip area in points, a point covers the subpixels from p*scale to p*scale+aa_factor-1
+            long long lo[2] = {floor_div(clip.x0-aa_factor+scale,scale),floor_div(clip.y0-aa_factor+scale,scale)};
+            long long hi[2] = {floor_div(clip.x1-1,scale),floor_div(clip.y1-1,scale)};
+
+            // Only the steps inside are walked, and every horizontal run of points is filled at once
+            Line line(x1*unit,y1*unit,x2*unit,y2*unit);
+            if(!line.clip(lo[0],lo[1],hi[0],hi[1])) return;
+            line.runs([&](long long from, long long to, long long y){
+                fill_area(from*scale,y*scale,to*scale+aa_factor-1,y*scale+aa_factor-1,r,g,b,clip);
+            });
+
+        }
+
+        static int clip_band(const double * in, int n, int axis, double bound, double * out){
+            // One step of Sutherland-Hodgman, keeps the part of a polygon (x,y,z for each point) on the inner side
+            // of p[axis] = bound (below a positive bound, above a negative one)
+            // out needs space for n+1 points, returns how many there are
+            // A crossing edge is cut from its outside point, so two triangles that share it cut it at the same place.
+
+            int count = 0;
+            for(int i = 0; i < n; i++){
+                const double * a = in+3*i, * b = in+3*((i+1)%n);
+                bool in_a = (bound > 0)?a[axis] <= bound:a[axis] >= bound;
+                bool in_b = (bound > 0)?b[axis] <= bound:b[axis] >= bound;
+                if(in_a){
+                    std::copy(a,a+3,out+3*count);
+                    count++;
+                }
+                if(in_a != in_b){
+                    const double * p = in_a?b:a, * q = in_a?a:b;
+                    double t = (bound-p[axis])/(q[axis]-p[axis]);
+                    for(int k = 0; k < 3; k++)
+                        out[3*count+k] = p[k]+(q[k]-p[k])*t;
+                    out[3*count+axis] = bound;
+                    count++;
+                }
+            }
+            return count;
+
+        }
+
+        void raster_triangle(const double * v, unsigned char r, unsigned char g, unsigned char b, const Rect & clip){
+            // Fills the triangle (x,y,z for each point) using edge functions, with a depth test
+            // Only the part inside the clip area is drawn. Every subpixel gets exactly the same result
+            // whatever the clip area is, so splitting a triangle between tiles does not change it.
+
+            // In fixed point, 16 steps per subpixel
+            const double scale = 16.0*aa_factor;
+            const double band = 1 << 25; // The guard band, keeps the edge functions well within 64 bits
+            double points[3*8];
+            bool inside = true;
+            for(int k = 0; k < 3; k++){
+                points[3*k] = v[3*k]*scale;
+                points[3*k+1] = v[3*k+1]*scale;
+                points[3*k+2] = v[3*k+2];
+                if(!(std::isfinite(points[3*k]) && std::isfinite(points[3*k+1]))) return;
+                if(!(fabs(points[3*k]) <= band && fabs(points[3*k+1]) <= band)) inside = false;
+            }
+            if(inside){
+                raster_fixed(points,r,g,b,clip);
+                return;
+            }
+
+            // A point past the guard band is clipped to it, the band does not depend on the clip area
+            // so every tile gets the same triangles. What is left is split into triangles around its first point
+            double other[3*8];
+            int n = clip_band(points,3,0,-band,other);
+            n = clip_band(other,n,0,band,points);
+            n = clip_band(points,n,1,-band,other);
+            n = clip_band(other,n,1,band,points);
+            for(int k = 1; k+1 < n; k++){
+                double part[9];
+                std::copy(points,points+3,part);
+                std::copy(points+3*k,points+3*k+6,part+3);
+                raster_fixed(part,r,g,b,clip);
             }
+
+        }
+
+        void raster_fixed(const double * v, unsigned char r, unsigned char g, unsigned char b, const Rect & clip){
+            // Fills a triangle inside the guard band, x and y already in fixed point (see raster_triangle)
+
+            // Snap the vertices to fixed point
+            long long X[3], Y[3];
+            double vz[3];
+            for(int k = 0; k < 3; k++){
+                X[k] = llround(v[3*k]);
+                Y[k] = llround(v[3*k+1]);
+                vz[k] = v[3*k+2];
+            }
+
+            // Make the triangle counter-clockwise, skip it if it has no area
+            long long area = (X[1]-X[0])*(Y[2]-Y[0])-(Y[1]-Y[0])*(X[2]-X[0]);
+            if(area == 0) return;
+            if(area < 0){
+                std::swap(X[1],X[2]);
+                std::swap(Y[1],Y[2]);
+                std::swap(vz[1],vz[2]);
+                area = -area;
+            }
+
+            // Find the bounding box in subpixels, clipped to the clip area
+            // The samples of the rotated grid are a quarter of a subpixel off the centers, so it reaches that much further
+            int reach = (aa_mode == AA_ROTATED)?4:0;
+            int minx = std::max((long long)clip.x0,(std::min(std::min(X[0],X[1]),X[2])-8-reach)>>4);
+            int miny = std::max((long long)clip.y0,(std::min(std::min(Y[0],Y[1]),Y[2])-8-reach)>>4);
+            int maxx = std::min((long long)clip.x1-1,(std::max(std::max(X[0],X[1]),X[2])-8+reach)>>4);
+            int maxy = std::min((long long)clip.y1-1,(std::max(std::max(Y[0],Y[1]),Y[2])-8+reach)>>4);
+            if(minx > maxx || miny > maxy) return;
+
+            // The samples are walked in classes that share the same place in their subpixel, every class is a grid
+            // of pitch subpixels. The ordered grids have one class with the samples on the centers. The rotated grid
+            // has four on every other subpixel, each one 1/4 of a subpixel off the center (the sample rows and columns
+            // of a pixel are then at 1/8, 3/8, 5/8 and 7/8 of it)
+            static const int ordered[1][4] = {{0,0,0,0}};
+            static const int rotated[4][4] = {{0,0,4,-4},{1,0,4,4},{0,1,-4,-4},{1,1,-4,4}}; // Column, row, x and y offset
+            const int (* classes)[4] = (aa_mode == AA_ROTATED)?rotated:ordered;
+            int pitch = (aa_mode == AA_ROTATED)?2:1, class_no = (aa_mode == AA_ROTATED)?4:1;
+
+            // The depth is interpolated by the edge functions, which are exact
+            double z0 = vz[0]/area, z1 = vz[1]/area, z2 = vz[2]/area;
+
+            for(int c = 0; c < class_no; c++){
+
+                // The first subpixel of the class in the box, and how many more there are in a row
+                int x0 = minx+(((classes[c][0]-minx)%pitch)+pitch)%pitch;
+                int y0 = miny+(((classes[c][1]-miny)%pitch)+pitch)%pitch;
+                if(x0 > maxx || y0 > maxy) continue;
+                long long last = (maxx-x0)/pitch;
+
+                // Set up the edges, edge k is the one across vertex k
+                // Its function is positive on the inside and steps by a constant per sample
+                long long stepx[3], stepy[3], row[3];
+                int bias[3];
+                long long px = ((long long)x0<<4)+8+classes[c][2], py = ((long long)y0<<4)+8+classes[c][3];
+                for(int k = 0; k < 3; k++){
+                    int a = (k+1)%3, b = (k+2)%3;
+                    long long dx = X[b]-X[a], dy = Y[b]-Y[a];
+                    stepx[k] = -dy*16*pitch;
+                    stepy[k] = dx*16*pitch;
+                    row[k] = dx*(py-Y[a])-dy*(px-X[a]);
+                    bias[k] = (dy < 0 || (dy == 0 && dx < 0))?0:-1; // Top-left rule
+                }
+
+                // Walk the rows of the bounding box, stepping the edge functions as you go
+                for(int y = y0; y <= maxy; y += pitch){
+
+                    // Every edge function is a line along the row, so the run where all three are
+                    // positive is found directly and nothing outside it is visited
+                    long long from = 0, to = last;
+                    for(int k = 0; k < 3; k++){
+                        long long w = row[k]+bias[k];
+                        if(stepx[k] > 0) from = std::max(from,-floor_div(w,stepx[k]));
+                        else if(stepx[k] < 0) to = std::min(to,floor_div(w,-stepx[k]));
+                        else if(w < 0) to = from-1;
+                    }
+
+                    long long w0 = row[0]+bias[0]+stepx[0]*from;
+                    long long w1 = row[1]+bias[1]+stepx[1]*from;
+                    long long w2 = row[2]+bias[2]+stepx[2]*from;
+                    int x = x0+from*pitch, index = y*sw+x;
+                    for(long long i = from; i <= to; i++, x += pitch, index += pitch){
+                        double z = (w0-bias[0])*z0+(w1-bias[1])*z1+(w2-bias[2])*z2;
+                        if(z > depth[index]){
+                            depth[index] = z;
+                            plot(index,x,y,r,g,b);
+                        }
+                        w0 += stepx[0];
+                        w1 += stepx[1];
+                        w2 += stepx[2];
+                    }
+                    for(int k = 0; k < 3; k++)
+                        row[k] += stepy[k];
+
+                }
+            }
+
+        }
+
+        void raster(const Primitive & p, const Rect & clip){
+            // Rasterizes a primitive from the bins
+            if(p.triangle)
+                raster_triangle(p.v,p.r,p.g,p.b,clip);
+            else
+                raster_line((int)p.v[0],(int)p.v[1],(int)p.v[2],(int)p.v[3],p.use_aa,p.r,p.g,p.b,clip);
+        }
+
+        void bin(const Primitive & p, double minx, double miny, double maxx, double maxy){
+            // Adds a primitive to the bins of all the tiles its bounding box (in subpixels) touches
+
+            // Find the tiles, skip the primitive if it is off the surface
+            // The box is clamped to the surface before it becomes tiles, a point can be very far off it
+            double tile = tile_size*aa_factor;
+            if(!(maxx >= 0 && maxy >= 0 && minx < sw && miny < sh)) return;
+            int tx0 = (int)(std::max(minx,0.0)/tile), ty0 = (int)(std::max(miny,0.0)/tile);
+            int tx1 = (int)(std::min(maxx,(double)sw-1)/tile), ty1 = (int)(std::min(maxy,(double)sh-1)/tile);
+
+            int index = pending.size();
+            pending.push_back(p);
+            for(int ty = ty0; ty <= ty1; ty++)
+                for(int tx = tx0; tx <= tx1; tx++)
+                    bins[ty*tiles_x+tx].push_back(index);
+
         }
 
 
@@ -262,75 +1097,166 @@ class Canvas{
             width = w;
             height = h;
 
-            // Create the surface array and fill it with pixels
-            // Note that the surface array should be size * aa_factor, to achieve the supersampling
-            surf = new Pixel**[w*aa_factor];
-            for(int i = 0; i < w*aa_factor; i++){
-                surf[i] = new Pixel*[h*aa_factor];
-                for(int j = 0; j < h*aa_factor; j++)
-                    surf[i][j] = new Pixel();
-            }
+            // Create the surface, without antialaising to begin with
+            allocate_surface();
+
+            // Create the bins, one for every tile
+            tiles_x = (w+tile_size-1)/tile_size;
+            tiles_y = (h+tile_size-1)/tile_size;
+            bins = new std::vector<int>[tiles_x*tiles_y];
+
+            // Nothing is on the terminal yet, so the first frame sends every pixel
+            span_lo = new int[h*tiles_x];
+            span_hi = new int[h*tiles_x];
+            reset_spans(true);
+            emitted = new char[2*w*h];
+            emitted_tints = (unsigned char *)(emitted+w*h);
+            std::fill(emitted,emitted+2*w*h,(char)0);
+
+            // The frame is resolved into color planes and a brightness plane, then shaded into the letters plane
+            // and the palette colors of the letters. They all live in one block
+            resolved = new unsigned char[6*w*h];
+            brightness = resolved+3*w*h;
+            letters = (char *)(brightness+w*h);
+            tints = brightness+2*w*h;
+            std::fill(resolved,resolved+6*w*h,(unsigned char)0);
+            shaded = new bool[h];
+            std::fill(shaded,shaded+h,false);
+            glyphs = new GlyphRamp();
+
+            // Create the emitter with enough space for a full frame, so it never grows while rendering
+            // Worst case is a cursor move, a color and two letters for every cell of the view and the border
+            emitter = new FrameEmitter((w+2)*(h+2)*25+64);
 
-            // Do the same for the buffer array
-            // The buffer array does not need to be larger than the canvas
-            buffer = new bool*[w];
-            for(int i = 0; i < w; i++){
-                buffer[i] = new bool[h];
-                for(int j = 0; j < h; j++)
-                    buffer[i][j] = false;
-            }
+        }
+
+        ~Canvas(){
 
-            // Create tempcolor for calculations and the drawing color
-            tempcolor = new Color(0,0,0);
-            if(!drawcolor) drawcolor = new Color(1,1,1);
+            // Delete the surface, the change tracking and the bins
+            delete[] surf;
+            delete[] row_sums;
+            delete[] divide;
+            delete[] span_lo;
+            delete[] span_hi;
+            delete[] emitted;
+            delete[] resolved;
+            delete[] shaded;
+            delete glyphs;
+            delete[] bins;
+            delete pool;
+
+            // Delete the emitters, the recorder belongs to the caller
+            delete emitter;
+            delete keyframe;
 
         }
 
-        ~Canvas(){
+        // Sets how many threads rasterize the lines and triangles (1 draws them right away)
+        void setThreads(int n){
+            flush();
+            delete pool;
+            pool = nullptr;
+            threads = (n > 1)?n:1;
+            if(threads > 1) pool = new ThreadPool(threads);
+        }
+
+        int getThreads(){
+            return threads;
+        }
+
+        // Sets the antialaising, one of the Antialias modes
+        // The surface is made again for the new number of subpixels, so it starts out black
+        // AA_ROTATED uses the 2x2 surface of AA_2X2 (see Antialias), only the triangles sample it differently
+        void setAA(int mode){
+
+            if(mode < AA_NONE || mode > AA_ROTATED) mode = AA_NONE;
+            if(mode == aa_mode) return;
+            flush();
 
-            // Delete the surface
-            for(int i = 0; i < width; i++){
-                for(int j = 0; j < height; j++){
-                    delete surf[i][j];
-                }
-                delete[] surf[i];
-            }
             delete[] surf;
+            delete[] row_sums;
+            delete[] divide;
+            aa_mode = mode;
+            aa_factor = (mode == AA_ROTATED)?2:mode;
+            aa_inverse = ((1ULL<<32)+aa_factor-1)/aa_factor;
+            allocate_surface();
+            reset_spans(true);
 
-            // Delete the buffer array
-            for(int i = 0; i < width; i++){
-                delete[] buffer[i];
-            }
-            delete[] buffer;
+        }
 
-            // Delete the temporary color
-            delete tempcolor;
+        int getAA(){
+            return aa_mode;
+        }
 
+        // Sets the letters pixels are shaded with, from the darkest to the brightest (see glyphs.hpp)
+        void setGlyphs(const char * ramp){
+            delete glyphs;
+            glyphs = new GlyphRamp(ramp);
+            reshade = true;
         }
 
-        // Getters for pixels
-        Color * getPixelColor(int x, int y){
+        GlyphRamp * getGlyphs(){
+            return glyphs;
+        }
 
-            // Reset the temp color
-            double rgb[3] = {0.0,0.0,0.0};
+        // Sets the colors of the output, one of the ColorModes
+        // Every letter takes the nearest color of the palette, and the whole view is sent again
+        void setColorMode(int mode){
+            color_mode = mode;
+            palette = (mode == COLOR_16)?palette_16():(mode == COLOR_256)?palette_256():nullptr;
+            std::fill(emitted,emitted+2*width*height,(char)0);
+            reshade = true;
+        }
 
-            for(int i = 0; i < aa_factor; i++){
-                for(int j = 0; j < aa_factor; j++){
+        int getColorMode(){
+            return color_mode;
+        }
 
-                    Pixel * p = surf[aa_factor*x+i][aa_factor*y+j];
-                    double * prgb = p->getColor()->getRGB();
-                    for(int rgb_i = 0; rgb_i < 3; rgb_i++){
-                        rgb[rgb_i] += prgb[rgb_i];
-                    }
-                }
-            }
+        // Sets the dithering, one of DITHER_NONE, DITHER_ORDERED or DITHER_FLOYD
+        void setDither(int mode){
+            dither = mode;
+            reshade = true;
+        }
+
+        int getDither(){
+            return dither;
+        }
+
+        // Rasterizes everything that waits in the bins, each tile on one thread
+        // Everything that reads the surface or draws without the bins calls this first
+        void flush(){
+
+            if(pending.empty()) return;
+
+            // Only the tiles that have something to draw become tasks
+            std::vector<int> tiles;
+            for(int t = 0; t < tiles_x*tiles_y; t++)
+                if(!bins[t].empty()) tiles.push_back(t);
+
+            pool->run(tiles.size(),[&](int task){
+                int t = tiles[task];
+                int size = tile_size*aa_factor;
+                Rect clip = {(t%tiles_x)*size,(t/tiles_x)*size,0,0};
+                clip.x1 = std::min(clip.x0+size,sw);
+                clip.y1 = std::min(clip.y0+size,sh);
+                for(int index : bins[t])
+                    raster(pending[index],clip);
+            });
+
+            // Empty the bins for the next primitives
+            for(int t : tiles)
+                bins[t].clear();
+            pending.clear();
+
+        }
 
-            // Divide by the pixel number
-            int aa_square = aa_factor*aa_factor;
-            delete tempcolor;
-            tempcolor = new Color(rgb[0]/aa_square,rgb[1]/aa_square,rgb[2]/aa_square);
+        // Getters for pixels
+        Color getPixelColor(int x, int y){
 
-            return tempcolor;
+            flush();
+            resolve_span(y,x,x);
+            const unsigned char * r = resolved+y*width+x;
+            return color_bytes(r[0],r[width*height],r[2*width*height]);
         }
 
 
@@ -339,50 +1265,166 @@ class Canvas{
         // Functions for rendering on the screen
         void render(){
             // This will render everything on the surface to the screen.
-            // Takes no parameters at the moment, but this will change pretty soon.
-
-            // Do that for all pixels
-            for(int x = 0; x <= width+1; x++){
-                for(int y = 0; y <= height+1; y++){
-
-                    // Draw the border around the view
-                    if(x == 0 || y == 0 || x == width+1 || y == height+1){
-                        if (framerendered) continue;
-                        gotoxy(1+2*x,height-y+2);
-                        printf("##");
-                        continue;
-                    }
-
-                    // Check if you need to draw the specific pixel
-                    else if(!buffer[x-1][y-1]){
-                        gotoxy(1+2*x,height-y+2);
-                        char c = getPixelColor(x-1,y-1)->getLetter();
-                        printf("%c%c",c,c);
-                        buffer[x-1][y-1] = true;
+            // The whole frame is collected by the emitter and written with a single call.
+
+            flush();
+
+            // Draw the border around the view on the first frame
+            bool first = !framerendered;
+            if(first) emit_border(emitter);
+
+            shade_frame();
+
+            // A pixel is only sent if its letter (or the color of it) differs from the one on the terminal
+            int sent_no = 0;
+            for(int y = height-1; y >= 0; y--){
+                char * row = letters+y*width, * sent = emitted+y*width;
+                unsigned char * row_tints = tints+y*width, * sent_tints = emitted_tints+y*width;
+                if(!shaded[y]) continue;
+                shaded[y] = false;
+                if(memcmp(row,sent,width) == 0 && (!palette || memcmp(row_tints,sent_tints,width) == 0)) continue;
+                for(int x = 0; x < width; x++){
+                    if(row[x] == sent[x] && (!palette || row_tints[x] == sent_tints[x])) continue;
+                    sent[x] = row[x];
+                    emitter->move(3+2*x,height-y+1);
+                    if(palette){
+                        sent_tints[x] = row_tints[x];
+                        if(row[x] != ' ' && row_tints[x] != tint){
+                            tint = row_tints[x];
+                            emitter->escape(palette->getEscape(tint));
+                        }
                     }
+                    emitter->put(row[x],2);
+                    sent_no++;
                 }
             }
 
-            gotoxy(0,height+3);
+            // Give the terminal its own color back, for anything printed after the frame
+            if(tint >= 0){
+                emitter->escape("\033[0m");
+                tint = -1;
+            }
+            emitter->move(0,height+3);
             framerendered = true;
 
-            // Flush the output
+            // Give the frame to the recorder, frames where nothing changed are left out
+            if(recorder){
+                if(recorder->keyframe_due()){
+                    emit_keyframe();
+                }else if(sent_no > 0 || first){
+                    recorder->record(emitter->getData(),emitter->getSize(),false);
+                }
+            }
+
+            // Anything printed through stdio has to reach the terminal before the frame
             fflush(stdout);
+            // If the terminal missed part of the frame, the next one sends the whole view again
+            if(!emitter->flush()){
+                redraw();
+                if(palette) emitter->escape("\033[0m");
+            }
 
         }
 
-        // Clean out the canvas with one color only
-        void draw_clear(Color * c = drawcolor){
+        // Headless rendering, for frames that are saved instead of shown (see target.hpp)
+        // This resolves and shades the frame like render does, but sends nothing to the terminal.
+        // A later render still sends everything that changed.
+        void render_offscreen(){
+            flush();
+            shade_frame();
+        }
+
+        // Copies the letters of the last rendered frame, a row of width letters at a time, the top row first
+        void copy_letters(char * out){
+            for(int y = 0; y < height; y++)
+                memcpy(out+(height-1-y)*width,letters+y*width,width);
+        }
 
-            for(int i = 0; i < width*aa_factor; i++){
-                for(int j = 0; j < height*aa_factor; j++)
-                    draw_point(i,j,c);
+        // Copies the resolved colors of the last rendered frame as red, green, blue bytes per pixel, the top row first
+        void copy_rgb(unsigned char * out){
+            const unsigned char * r = resolved, * g = r+width*height, * b = g+width*height;
+            for(int y = 0; y < height; y++){
+                unsigned char * dest = out+3*(height-1-y)*width;
+                for(int x = 0; x < width; x++){
+                    dest[3*x] = r[y*width+x];
+                    dest[3*x+1] = g[y*width+x];
+                    dest[3*x+2] = b[y*width+x];
+                }
             }
         }
 
+        // Copies the brightness of the last rendered frame, one byte per pixel, the top row first
+        void copy_brightness(unsigned char * out){
+            for(int y = 0; y < height; y++)
+                memcpy(out+(height-1-y)*width,brightness+y*width,width);
+        }
+
+        // Getters for the size in pixels
+        int getWidth(){
+            return width;
+        }
+
+        int getHeight(){
+            return height;
+        }
+
+        // Makes the next render send the border and every pixel again, e.g. after the terminal was cleared
+        void redraw(){
+            framerendered = false;
+            std::fill(emitted,emitted+width*height,(char)0);
+            reset_spans(true);
+            emitter->forget_cursor();
+        }
+
+        // Sets a recorder that gets every rendered frame, nullptr stops recording (the recorder is not deleted)
+        void setRecorder(Recorder * r){
+            recorder = r;
+        }
+
+        // Makes a recorder for an asciicast file with the size of the canvas on the terminal and sets it
+        // Returns nullptr if the file can't be made, the caller deletes the recorder when done
+        Recorder * record(const char * path, double keyframe_seconds = 10.0){
+            Recorder * r = new Recorder(path,2*(width+2),height+3,keyframe_seconds);
+            if(!r->isOpen()){
+                delete r;
+                return nullptr;
+            }
+            recorder = r;
+            return r;
+        }
+
+        Recorder * getRecorder(){
+            return recorder;
+        }
+
+        // Returns the emitter, e.g. to redirect the output of render
+        FrameEmitter * getEmitter(){
+            return emitter;
+        }
+
+        // Returns how many bytes the last rendered frame sent to the terminal
+        long getFrameBytes(){
+            return emitter->getFrameBytes();
+        }
+
+        // Clean out the canvas with one color only, the z-buffer is reset to the farthest depth
+        void draw_clear(Color c = drawcolor){
+
+            flush();
+            std::fill(depth,depth+sw*sh,0.0f);
+
+            // Fill every plane in memory order, all the pixels count as drawn
+            int n = sw*sh;
+            std::fill(red,red+n,c.r);
+            std::fill(green,green+n,c.g);
+            std::fill(blue,blue+n,c.b);
+            reset_spans(true);
+        }
+
         // This function is different from draw_point because it will fill a single pixel on any aa_factor
-        void draw_pixel(int x, int y, Color * c = drawcolor){
-            
+        void draw_pixel(int x, int y, Color c = drawcolor){
+
+            flush();
             // Scale the coords according to aa
             x *= aa_factor;
             y *= aa_factor;
@@ -394,150 +1436,225 @@ class Canvas{
 
         }
 
-        void draw_line(int x1,int y1, int x2, int y2,bool use_aa = false, Color * c = drawcolor){
+        void draw_line(int x1,int y1, int x2, int y2,bool use_aa = false, Color c = drawcolor){
             // This is done using the bresenham line method, see above
 
-            // Perform the antialaising correction
-            if(use_aa){
-                x1 *= aa_factor;
-                x2 *= aa_factor;
-                y1 *= aa_factor;
-                y2 *= aa_factor;
-            }
+            unsigned char r = c.r, g = c.g, b = c.b;
 
-            // Find the length of the result
-            int res_len;
-            
-            // Call bresenham line for the points
-            int * res = bresenham_line(x1,y1,x2,y2,res_len);
-
-            // Draw all the points of the line
-            if(use_aa){
-                for(int i = 0; i < res_len; i++){
-                    draw_point_aa(res[2*i],res[2*i+1],c);
-                }
-            }else{
-                for(int i = 0; i < res_len; i++){
-                    draw_pixel(res[2*i],res[2*i+1],c);
-                }
+            // Draw right away on a single thread
+            if(!pool){
+                raster_line(x1,y1,x2,y2,use_aa,r,g,b,full());
+                return;
             }
 
-            // Delete the result after drawing
-            delete[] res;
+            // Otherwise wait in the bins, the bounding box is in subpixels
+            Primitive p = {false,use_aa,r,g,b,{(double)x1,(double)y1,(double)x2,(double)y2}};
+            bin(p,(double)std::min(x1,x2)*aa_factor,(double)std::min(y1,y2)*aa_factor,
+                (double)std::max(x1,x2)*aa_factor+aa_factor-1,(double)std::max(y1,y2)*aa_factor+aa_factor-1);
 
         }
 
-        void draw_circle(double xc,double yc, double r,Color * c = drawcolor){
+        void draw_circle(double xc,double yc, double r,Color c = drawcolor){
+
+            flush();
 
             xc *= aa_factor;
             yc *= aa_factor;
             r *= aa_factor;
 
             // Draws a circle around (xc,yc) with radius = r
-            // This is using a modified bresenham
-            int xx = 0, yy = r, e = -r;
+            // This is using a modified bresenham, with 8-symmetry. Every point is a whole pixel of subpixels.
+            // The points near the top and bottom share rows, so they are gathered into runs and filled at once
+            unsigned char cr = c.r, cg = c.g, cb = c.b;
+            Rect clip = full();
+            int f = aa_factor-1;
+            int xo = xc, yo = yc;
+            int xx = 0, yy = r, e = -r, from = 0;
             while(xx <= yy){
-                draw_point_8(xx,yy,xc,yc,c);
+
+                // The points near the sides are alone on their rows
+                plot_block(xo+yy,yo+xx,cr,cg,cb);
+                plot_block(xo-yy,yo+xx,cr,cg,cb);
+                plot_block(xo+yy,yo-xx,cr,cg,cb);
+                plot_block(xo-yy,yo-xx,cr,cg,cb);
+
+                int run_y = yy;
                 e += 2*xx+1;
                 xx++;
                 if (e >= 0){
                     e -= 2*yy-2;
                     yy--;
                 }
+
+                // A run ends when the row changes, or when the circle does
+                if(yy != run_y || xx > yy){
+                    fill_area(xo+from,yo+run_y,xo+xx-1+f,yo+run_y+f,cr,cg,cb,clip);
+                    fill_area(xo-xx+1,yo+run_y,xo-from+f,yo+run_y+f,cr,cg,cb,clip);
+                    fill_area(xo+from,yo-run_y,xo+xx-1+f,yo-run_y+f,cr,cg,cb,clip);
+                    fill_area(xo-xx+1,yo-run_y,xo-from+f,yo-run_y+f,cr,cg,cb,clip);
+                    from = xx;
+                }
+
             }
 
         }
 
-        void draw_triangle(int x1, int y1, int x2, int y2, int x3, int y3, Color * c = drawcolor){
-            // Draws the triangle using bresenham (fast and reliable)
+        // The filled shapes below find the span of every row once and write it as a single run
+        // They are drawn on top of what is there, without a depth test, like the lines
+        void fill_rect(int x1, int y1, int x2, int y2, Color c = drawcolor){
+            // Fills the pixels from (x1,y1) to (x2,y2), both corners included
 
-            //Pypass to test things
-            draw_line(x1,y1,x2,y2,c);
-            draw_line(x2,y2,x3,y3,c);
-            draw_line(x3,y3,x1,y1,c);
-            return;
+            flush();
+            if(x1 > x2) std::swap(x1,x2);
+            if(y1 > y2) std::swap(y1,y2);
+            long long f = aa_factor;
+            fill_area(x1*f,y1*f,x2*f+f-1,y2*f+f-1,c.r,c.g,c.b,full());
 
+        }
 
-            // Scale the triangle for aa
-            x1 *= aa_factor;
-            y1 *= aa_factor;
-            x2 *= aa_factor;
-            y2 *= aa_factor;
-            x3 *= aa_factor;
-            y3 *= aa_factor;
+        void fill_circle(double xc, double yc, double r, Color c = drawcolor){
+            // Fills the circle that draw_circle draws, outline included
+            // The half width of every row is found on its own (see circle_half_width), so only the rows
+            // on the surface are visited however big the circle is
 
+            flush();
 
-            //Check which point is in the middle (height wise)
-            int miny = std::min(std::min(y1,y2),y3), maxy = std::max(std::max(y1,y2),y3);
-            int ex1, ey1, ex2, ey2; // Edge points
-            int mx, my; // Middle point
-            if(y2 == miny && y3 == maxy || y3 == miny && y2 == maxy){
-                // point 1 in the middle
-                mx = x1; my = y1;
-                ex1 = x2; ey1 = y2; ex2 = x3; ey2 = y3;
-            }else if(y1 == miny && y3 == maxy || y3 == miny && y1 == maxy){
-                // point2 in the middle
-                mx = x2; my = y2;
-                ex1 = x1; ey1 = y1; ex2 = x3; ey2 = y3;
-            }else{
-                //Point three in the middle
-                mx = x3; my = y3;
-                ex1 = x1; ey1 = y1; ex2 = x2; ey2 = y2;
-            }
-
-            // Now that we have the middle points, we can bresenham the two distances
-            int rb_len, r1_len, r2_len;
-            int * resbig = bresenham_line(ex1,ey1,ex2,ey2,rb_len);
-            int * res1small = bresenham_line(ex1,ey1,mx,my,r1_len);
-            int * res2small = bresenham_line(mx,my,ex2,ey2,r2_len);
-            int * ressmall = res1small;
-            int rs_len = r1_len;
-            int i = 0, j = 0;
-            int lasty = -10;
-            bool changed = false;
-
-            for(int i = 0; i < rb_len; i++){
-                
-                //Find the y on the big line
-                int by = resbig[2*i+1];
-                int bx = resbig[2*i];
-
-                //If it is the same as last y then just draw the extra point
-                if(by == lasty){
-                    draw_point(bx,by,c);
-                    continue;
+            // Far away circles are kept far away, every sum below stays well within 64 bits
+            const double limit = (double)(1LL << 60);
+            xc *= aa_factor;
+            yc *= aa_factor;
+            r *= aa_factor;
+            if(!(r >= 0) || !std::isfinite(xc) || !std::isfinite(yc)) return;
+            long long xo = (long long)std::max(-limit,std::min(xc,limit)), yo = (long long)std::max(-limit,std::min(yc,limit));
+            long long radius = (long long)std::min(r,limit), f = aa_factor;
+
+            // The rows of the surface the circle covers, every point is aa_factor subpixels tall
+            long long top = std::max(yo-radius,0LL), bottom = std::min(yo+radius+f-1,(long long)sh-1);
+
+            // Row y is covered by the points of the rows from y-f+1 to y, and the widest of them is the one closest to the center
+            unsigned char cr = c.r, cg = c.g, cb = c.b;
+            Rect clip = full();
+            for(long long y = top; y <= bottom; y++){
+                long long lo = std::max(y-yo-f+1,-radius), hi = std::min(y-yo,radius);
+                if(lo > hi) continue;
+                long long w = circle_half_width(radius,(lo > 0)?lo:(hi < 0)?-hi:0);
+                fill_area(xo-w,y,xo+w+f-1,y,cr,cg,cb,clip);
+            }
+
+        }
+
+        void fill_polygon(const double * points, int n, Color c = drawcolor){
+            // Fills a polygon of n points (x,y pairs in pixels), which can be concave or cross itself
+            // It uses a scanline with an active edge table: the edges are sorted by the first row they cross,
+            // and every row keeps the ones that cross it, sorted by x. A subpixel is filled when its center
+            // is inside by the even-odd rule, so polygons that share an edge do not overlap.
+
+            flush();
+            if(n < 3) return;
+
+            // Build the edge table, the edges that are flat or cross no row center are left out
+            double f = aa_factor;
+            edge_table.clear();
+            for(int i = 0; i < n; i++){
+                double xa = points[2*i]*f, ya = points[2*i+1]*f;
+                double xb = points[2*((i+1)%n)]*f, yb = points[2*((i+1)%n)+1]*f;
+                if(!(std::isfinite(xa) && std::isfinite(ya) && std::isfinite(xb) && std::isfinite(yb))) return;
+                if(ya > yb){
+                    std::swap(xa,xb);
+                    std::swap(ya,yb);
                 }
-                lasty = by;
-
-                // Then find the coords on the small line
-                int sx = ressmall[2*j];
-                int sy = ressmall[2*j+1];
-
-                // Draw the inbetween points
-                for(int xx = std::min(sx,bx); xx <= std::max(sx,bx); xx++)
-                    draw_point(xx,by,c);
-
-                // Finally, iterate the small line until a change in y (draw the points as you go)
-                while(sy == lasty){
-                    if(j == rs_len-1){
-                        //Change the line
-                        if(changed) break;
-                        ressmall = res2small;
-                        rs_len = r2_len;
-                        j = 0;
-                        changed = true;
-                    }
-                    j++;
-                    sx = ressmall[2*j];
-                    sy = ressmall[2*j+1];
-                    draw_point(sx,sy,c);
+
+                // The centers at row+0.5 from ya (included) to yb (not included), only the rows of the surface
+                double first = std::max(ceil(ya-0.5),0.0), last = std::min(ceil(yb-0.5)-1,(double)sh-1);
+                if(first > last) continue;
+                PolygonEdge edge;
+                edge.first = (int)first;
+                edge.last = (int)last;
+                edge.step = (xb-xa)/(yb-ya);
+                edge.x = xa+(first+0.5-ya)*edge.step;
+                edge_table.push_back(edge);
+            }
+            std::sort(edge_table.begin(),edge_table.end(),[](const PolygonEdge & a, const PolygonEdge & b){
+                return a.first < b.first;
+            });
+            if(edge_table.empty()) return;
+
+            unsigned char cr = c.r, cg = c.g, cb = c.b;
+            Rect clip = full();
+            active_edges.clear();
+            size_t next = 0;
+            for(int y = edge_table[0].first; y < sh && (next < edge_table.size() || !active_edges.empty()); y++){
+
+                // Drop the edges that ended and add the ones that start here
+                int kept = 0;
+                for(const PolygonEdge & edge : active_edges)
+                    if(edge.last >= y) active_edges[kept++] = edge;
+                active_edges.resize(kept);
+                while(next < edge_table.size() && edge_table[next].first == y)
+                    active_edges.push_back(edge_table[next++]);
+
+                // Keep them sorted by x, they are almost sorted from the row before so insertion sort is quick
+                for(size_t i = 1; i < active_edges.size(); i++){
+                    PolygonEdge edge = active_edges[i];
+                    size_t j = i;
+                    for(; j > 0 && active_edges[j-1].x > edge.x; j--)
+                        active_edges[j] = active_edges[j-1];
+                    active_edges[j] = edge;
+                }
+
+                // Fill between every pair, the subpixels with centers from the first x up to the second
+                for(size_t i = 0; i+1 < active_edges.size(); i += 2){
+                    double from = ceil(active_edges[i].x-0.5), to = ceil(active_edges[i+1].x-0.5)-1;
+                    if(from > to || to < 0 || from >= sw) continue;
+                    fill_area((long long)std::max(from,0.0),y,(long long)std::min(to,(double)sw-1),y,cr,cg,cb,clip);
                 }
+
+                for(PolygonEdge & edge : active_edges)
+                    edge.x += edge.step;
+
+            }
+
+        }
+
+        void draw_triangle(int x1, int y1, int x2, int y2, int x3, int y3, Color c = drawcolor){
+            // Draws the outline of the triangle using bresenham (fast and reliable)
+            draw_line(x1,y1,x2,y2,true,c);
+            draw_line(x2,y2,x3,y3,true,c);
+            draw_line(x3,y3,x1,y1,true,c);
+        }
+
+        void fill_triangle(double x1, double y1, double z1, double x2, double y2, double z2,
+            double x3, double y3, double z3, Color c = drawcolor){
+            // Fills the triangle using edge functions, with a depth test against the z-buffer
+            // The coordinates are in pixels, z is the depth after the projection (larger is closer).
+            // A subpixel is covered when its center is inside the triangle. Centers that lie exactly
+            // on an edge only count for top and left edges, so triangles sharing an edge never overlap.
+
+            Primitive p = {true,false,c.r,c.g,c.b,
+                {x1,y1,z1,x2,y2,z2,x3,y3,z3}};
+
+            // Draw right away on a single thread
+            if(!pool){
+                raster_triangle(p.v,p.r,p.g,p.b,full());
+                return;
             }
 
+            // Otherwise wait in the bins, the bounding box is in subpixels
+            bin(p,std::min(std::min(x1,x2),x3)*aa_factor-1,std::min(std::min(y1,y2),y3)*aa_factor-1,
+                std::max(std::max(x1,x2),x3)*aa_factor+1,std::max(std::max(y1,y2),y3)*aa_factor+1);
+
         }
 
-        void draw_triangle(Triangle *tri, Color * c){
+        void draw_triangle(Triangle *tri, Color c){
             // Draws a triangle set by the space file. Rounds coordinates to the best approximate pixel
+            // If it crosses the near plane the edges are clipped to it first
+
+            Vec4 clip[3];
+            if(triangle_clip_space(tri,clip)){
+                for(int k = 0; k < 3; k++)
+                    draw_clipped(clip[k],clip[(k+1)%3],c);
+                return;
+            }
             
             // Get each coordinate from the points of the Triangle
             double x1 = tri->getPoint(0)->getX(), y1 = tri->getPoint(0)->getY();
@@ -549,14 +1666,108 @@ class Canvas{
 
         }
 
-        void draw_cube(Cube * cube, Color * c){
+        void fill_triangle(Triangle *tri, Color c = drawcolor){
+            // Fills a triangle set by the space file, using the depth of its points
+            // If it crosses the near plane it is clipped to it first
+            Vec4 clip[3];
+            if(triangle_clip_space(tri,clip)){
+                fill_clipped(clip[0],clip[1],clip[2],c);
+                return;
+            }
+            Point * p1 = tri->getPoint(0), * p2 = tri->getPoint(1), * p3 = tri->getPoint(2);
+            fill_triangle(p1->getX(),p1->getY(),p1->getZ(),p2->getX(),p2->getY(),p2->getZ(),
+                p3->getX(),p3->getY(),p3->getZ(),c);
+        }
+
+        void fill_mesh(Mesh * mesh, Color c = drawcolor){
+            // Fills all the triangles of a transformed mesh, hidden parts are removed by the z-buffer
+            // Meshes outside the view and triangles facing away are skipped, depending on the culling
+            int view = cull(mesh,mesh->getMatrix());
+            if(view != VIEW_OUTSIDE) fill_culled(mesh,view,c);
+        }
+
+        void fill_mesh(Mesh * mesh, Transform * trans, Color c = drawcolor){
+            // Transforms and fills a mesh, a mesh outside the view is not even transformed
+            int view = cull(mesh,trans->getMatrix());
+            if(view == VIEW_OUTSIDE) return;
+            mesh->transform(trans);
+            fill_culled(mesh,view,c);
+        }
+
+        void draw_mesh(Mesh * mesh, Color c = drawcolor){
+            // Draws the wireframe of a transformed mesh, every edge is drawn once
+            // Meshes outside the view and edges between triangles facing away are skipped, depending on the culling
+            int view = cull(mesh,mesh->getMatrix());
+            if(view != VIEW_OUTSIDE) draw_culled(mesh,view,c);
+        }
+
+        void draw_mesh(Mesh * mesh, Transform * trans, Color c = drawcolor){
+            // Transforms and draws the wireframe of a mesh, a mesh outside the view is not even transformed
+            int view = cull(mesh,trans->getMatrix());
+            if(view == VIEW_OUTSIDE) return;
+            mesh->transform(trans);
+            draw_culled(mesh,view,c);
+        }
+
+        // Instanced drawing: many copies of one mesh, each placed by its own model matrix and seen through the camera
+        // The geometry is shared, every instance is culled by the box of the mesh, transformed into the screen
+        // buffers of the mesh and rasterized before the next one, so nothing is allocated per instance.
+        // The mesh is left transformed by the last instance that was in view.
+        void fill_instances(Mesh * mesh, Transform * camera, const Mat3x4 * models, int n, Color c = drawcolor){
+            const Mat4 & view = camera->getMatrix();
+            for(int i = 0; i < n; i++)
+                instance(mesh,view*models[i],c,true);
+        }
+
+        void fill_instances(Mesh * mesh, Transform * camera, Transform * const * models, int n, Color c = drawcolor){
+            const Mat4 & view = camera->getMatrix();
+            for(int i = 0; i < n; i++)
+                instance(mesh,view*models[i]->getMatrix(),c,true);
+        }
+
+        void draw_instances(Mesh * mesh, Transform * camera, const Mat3x4 * models, int n, Color c = drawcolor){
+            const Mat4 & view = camera->getMatrix();
+            for(int i = 0; i < n; i++)
+                instance(mesh,view*models[i],c,false);
+        }
 
-            // Draw all the triangles of the cube
-            for(int i = 0; i < 12; i++)
-                draw_triangle(cube->getTriangle(i),c);
+        void draw_instances(Mesh * mesh, Transform * camera, Transform * const * models, int n, Color c = drawcolor){
+            const Mat4 & view = camera->getMatrix();
+            for(int i = 0; i < n; i++)
+                instance(mesh,view*models[i]->getMatrix(),c,false);
+        }
+
+        // Sets the culling, a combination of the Culling modes (frustum culling is on by default)
+        void setCulling(int mode){
+            culling = mode;
+        }
+
+        int getCulling(){
+            return culling;
+        }
+
+        // Sets the closest distance from the camera that can be seen
+        void setNearPlane(double distance){
+            near_plane = distance;
+        }
+
+        // Sets the sign w has in front of the camera for matrices with a projection
+        // matrix_per puts the view z in w, which is negative in front (-1, the default). Projections that put
+        // the distance in w, like the ones of OpenGL, need 1. Matrices without a projection don't depend on it.
+        void setProjectionFront(int sign){
+            projection_front = (sign < 0)?-1:1;
+        }
+
+        // Counters of what the culling removed
+        CullStats getCullStats(){
+            return stats;
+        }
 
+        void resetCullStats(){
+            stats = CullStats();
         }
 
 
 };
 
+#endif
@@ -0,0 +1,252 @@
+#include <cstdio>
+#include <cstdint>
+#include <type_traits>
+
+#ifndef _colorr
+#define _colorr
+
+struct ColorF;
+
+struct Color{
+    // A color packed in four bytes, red, green, blue and alpha from 0 to 255
+    // It's small and trivially copyable, so it's passed around by value like a number.
+    // The constructor takes channels from 0 to 1 (anything outside is clamped), use color_bytes for bytes.
+
+    unsigned char r, g, b, a;
+
+    // Converts a channel from 0-1 to the 0-255 range, rounded
+    static constexpr unsigned char channel(double v){
+        return !(v > 0)?0:(v >= 1)?255:(unsigned char)(v*255.0+0.5);
+    }
+
+    constexpr Color() : r(0), g(0), b(0), a(255){}
+
+    constexpr Color(double red, double green, double blue, double alpha = 1.0)
+        : r(channel(red)), g(channel(green)), b(channel(blue)), a(channel(alpha)){}
+
+    inline Color(const ColorF & other);
+
+    // Those return basic colors individually, from 0 to 1
+    double getRed() const{
+        return r/255.0;
+    }
+    double getGreen() const{
+        return g/255.0;
+    }
+    double getBlue() const{
+        return b/255.0;
+    }
+    double getAlpha() const{
+        return a/255.0;
+    }
+
+    // The channels in order, from 0 to 1
+    double operator[](int index) const{
+        return ((index == 0)?r:(index == 1)?g:(index == 2)?b:a)/255.0;
+    }
+
+    // Value is derived by the mean of colors
+    double getValue() const{
+        return (r+g+b)/(3*255.0);
+    }
+
+    // This is for ascii matching
+    // The canvas shades through a GlyphRamp instead, this is for a single color
+    char getLetter() const{
+        static const char pallete[] = " o0@";
+        return pallete[(r+g+b)/255];
+    }
+
+    // All four channels as one number, red in the lowest byte
+    uint32_t packed() const{
+        return r|(g<<8)|(b<<16)|((uint32_t)a<<24);
+    }
+
+    //Function to determine if two colors are the same
+    bool equals(Color other) const{
+        return packed() == other.packed();
+    }
+
+    bool operator==(Color other) const{
+        return equals(other);
+    }
+
+    bool operator!=(Color other) const{
+        return !equals(other);
+    }
+
+};
+
+static_assert(sizeof(Color) == 4 && std::is_trivially_copyable<Color>::value,"Color must stay a packed value");
+
+constexpr Color color_bytes(unsigned char r, unsigned char g, unsigned char b, unsigned char a = 255){
+    // A color from bytes, 0 to 255 per channel
+    Color c;
+    c.r = r;
+    c.g = g;
+    c.b = b;
+    c.a = a;
+    return c;
+}
+
+struct ColorF{
+    // A color as four floats from 0 to 1, for math on colors (blending, lighting) before packing them
+
+    float r, g, b, a;
+
+    constexpr ColorF() : r(0), g(0), b(0), a(1){}
+
+    constexpr ColorF(float red, float green, float blue, float alpha = 1.0f)
+        : r(red), g(green), b(blue), a(alpha){}
+
+    constexpr ColorF(Color c) : r(c.r/255.0f), g(c.g/255.0f), b(c.b/255.0f), a(c.a/255.0f){}
+
+    ColorF operator+(const ColorF & other) const{
+        return ColorF(r+other.r,g+other.g,b+other.b,a+other.a);
+    }
+
+    ColorF operator*(float s) const{
+        return ColorF(r*s,g*s,b*s,a*s);
+    }
+
+    // Mixes towards other, t = 0 gives this color and t = 1 the other one
+    ColorF mix(const ColorF & other, float t) const{
+        return *this*(1-t)+other*t;
+    }
+
+};
+
+static_assert(sizeof(ColorF) == 16 && std::is_trivially_copyable<ColorF>::value,"ColorF must stay a packed value");
+
+inline Color::Color(const ColorF & other)
+    : r(channel(other.r)), g(channel(other.g)), b(channel(other.b)), a(channel(other.a)){}
+
+
+// Color modes of the terminal output, for Canvas::setColorMode
+enum ColorModes{
+    COLOR_NONE, // Only letters, in the color the terminal already has
+    COLOR_16, // The 16 standard colors
+    COLOR_256 // The 256 color palette (its 6x6x6 cube and the grays)
+};
+
+class Palette{
+    // A set of terminal colors with a table that finds the nearest of them for any color
+    // The table is indexed by the top bits of red, green and blue (32x32x32 cells) and every cell
+    // holds the color nearest to its middle, so finding one is a few shifts and a load.
+    // The distance weighs green most and red least, roughly like the eye does.
+
+    private:
+
+        static const int table_bits = 5;
+        static const int table_size = 1<<(3*table_bits);
+
+        Color * colors; // The colors of the palette
+        char (* escapes)[16]; // The escape sequence that sets each color as the letter color
+        int color_no;
+        unsigned char * table; // The nearest color of every cell
+
+    public:
+
+        Palette(const Color * list, const int * codes, int n, bool extended){
+            // Makes a palette of n colors (up to 255), codes are their numbers on the terminal
+            // Extended palettes are set with 38;5;code, the others with the code itself (30-37, 90-97)
+
+            color_no = (n < 255)?n:255;
+            colors = new Color[color_no];
+            escapes = new char[color_no][16];
+            for(int i = 0; i < color_no; i++){
+                colors[i] = list[i];
+                if(extended) snprintf(escapes[i],16,"\033[38;5;%dm",codes[i]);
+                else snprintf(escapes[i],16,"\033[%dm",codes[i]);
+            }
+
+            // Fill the table, the middle of a cell is its top bits with a half step below them
+            table = new unsigned char[table_size];
+            const int step = 256>>table_bits;
+            for(int cell = 0; cell < table_size; cell++){
+                int r = ((cell>>(2*table_bits))&((1<<table_bits)-1))*step+step/2;
+                int g = ((cell>>table_bits)&((1<<table_bits)-1))*step+step/2;
+                int b = (cell&((1<<table_bits)-1))*step+step/2;
+                int best = 0;
+                long best_distance = -1;
+                for(int i = 0; i < color_no; i++){
+                    long dr = r-colors[i].r, dg = g-colors[i].g, db = b-colors[i].b;
+                    long distance = 2*dr*dr+4*dg*dg+3*db*db;
+                    if(best_distance < 0 || distance < best_distance){
+                        best = i;
+                        best_distance = distance;
+                    }
+                }
+                table[cell] = best;
+            }
+
+        }
+
+        ~Palette(){
+            delete[] colors;
+            delete[] escapes;
+            delete[] table;
+        }
+
+        Palette(const Palette &) = delete;
+        Palette & operator=(const Palette &) = delete;
+
+        // The index of the palette color nearest to c
+        int nearest(Color c) const{
+            return table[((c.r>>(8-table_bits))<<(2*table_bits))|((c.g>>(8-table_bits))<<table_bits)|(c.b>>(8-table_bits))];
+        }
+
+        // Getters
+        Color getColor(int i) const{
+            return colors[i];
+        }
+
+        const char * getEscape(int i) const{
+            return escapes[i];
+        }
+
+        int getColorNo() const{
+            return color_no;
+        }
+
+};
+
+// The standard palettes, made the first time they are asked for
+const Palette * palette_16(){
+    // The 16 colors as xterm shows them by default
+    static const unsigned char rgb[16][3] = {
+        {0,0,0},{205,0,0},{0,205,0},{205,205,0},{0,0,238},{205,0,205},{0,205,205},{229,229,229},
+        {127,127,127},{255,0,0},{0,255,0},{255,255,0},{92,92,255},{255,0,255},{0,255,255},{255,255,255}};
+    static const Palette * palette = []{
+        Color colors[16];
+        int codes[16];
+        for(int i = 0; i < 16; i++){
+            colors[i] = color_bytes(rgb[i][0],rgb[i][1],rgb[i][2]);
+            codes[i] = (i < 8)?30+i:90+i-8;
+        }
+        return new Palette(colors,codes,16,false);
+    }();
+    return palette;
+}
+
+const Palette * palette_256(){
+    // Colors 16 to 255, the 6x6x6 cube and 24 grays, which look the same on every terminal
+    // (the first 16 are left out, terminals show them in their own ways)
+    static const Palette * palette = []{
+        static const int levels[6] = {0,95,135,175,215,255};
+        Color colors[240];
+        int codes[240];
+        for(int i = 0; i < 216; i++){
+            colors[i] = color_bytes(levels[i/36],levels[(i/6)%6],levels[i%6]);
+            codes[i] = 16+i;
+        }
+        for(int i = 0; i < 24; i++){
+            colors[216+i] = color_bytes(8+10*i,8+10*i,8+10*i);
+            codes[216+i] = 232+i;
+        }
+        return new Palette(colors,codes,240,true);
+    }();
+    return palette;
+}
+
+#endif
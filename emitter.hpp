@@ -0,0 +1,170 @@
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <poll.h>
+#endif
+
+#ifndef _emitterr
+#define _emitterr
+
+class FrameEmitter{
+    // This class builds the byte stream of a whole frame (cursor moves and letters)
+    // in a reusable buffer and hands it to the terminal with a single write.
+    // It also keeps track of the cursor, so consecutive cells don't need a move each.
+
+    private:
+
+        char * data; // The bytes of the current frame
+        int size, capacity; // Used and allocated bytes of the buffer
+        int fd; // Where the frame is written, negative means it gets discarded
+        int curx, cury; // Where the terminal cursor is after the bytes so far (-1 if unknown)
+
+        // Counters for the output
+        long frame_bytes; // Bytes of the last flushed frame
+        long total_bytes; // Bytes of all the flushed frames
+        long frames; // Number of flushed frames
+
+        void reserve(int extra){
+            // Makes sure that there is space for extra bytes, grows the buffer if not
+            if(size+extra <= capacity) return;
+            while(capacity < size+extra) capacity *= 2;
+            char * newdata = new char[capacity];
+            memcpy(newdata,data,size);
+            delete[] data;
+            data = newdata;
+        }
+
+    public:
+
+        FrameEmitter(int initial_capacity = 4096, int output = 1){
+            // Creates an empty emitter that writes to the given file descriptor (stdout by default)
+            capacity = (initial_capacity > 16)?initial_capacity:16;
+            data = new char[capacity];
+            size = 0;
+            fd = output;
+            curx = cury = -1;
+            frame_bytes = total_bytes = frames = 0;
+        }
+
+        ~FrameEmitter(){
+            delete[] data;
+        }
+
+        // Preallocates the buffer so a frame of that many bytes never needs to grow it
+        void preallocate(int bytes){
+            reserve(bytes-size);
+        }
+
+        // Moves the terminal cursor, skipped if the cursor is already there
+        void move(int x, int y){
+            if(x < 1) x = 1; // The terminal treats column 0 as 1
+            if(x == curx && y == cury) return;
+            reserve(24);
+            size += sprintf(data+size,"\033[%d;%dH",y,x);
+            curx = x;
+            cury = y;
+        }
+
+        // Writes characters at the cursor, the cursor advances with them
+        void put(char c){
+            reserve(1);
+            data[size++] = c;
+            if(curx >= 0) curx++;
+        }
+
+        void put(char c, int times){
+            reserve(times);
+            memset(data+size,c,times);
+            size += times;
+            if(curx >= 0) curx += times;
+        }
+
+        // Writes any escape sequence that does not move the cursor
+        void escape(const char * seq){
+            int len = strlen(seq);
+            reserve(len);
+            memcpy(data+size,seq,len);
+            size += len;
+        }
+
+        // The cursor position is forgotten, e.g. if something else wrote to the terminal
+        void forget_cursor(){
+            curx = cury = -1;
+        }
+
+        // Sends the whole frame out and empties the buffer
+        // Returns false if the output failed part way, then the terminal misses some of the frame
+        // and the cursor is forgotten, so the caller has to send everything again
+        bool flush(){
+
+            // Write everything in one go, looping if the system accepts less
+            // A write cut short by a signal (like a resize) is tried again, a full pipe is waited on
+            bool sent = true;
+            if(fd >= 0){
+                int done = 0;
+                while(done < size){
+                    int w = write(fd,data+done,size-done);
+                    if(w > 0){
+                        done += w;
+                        continue;
+                    }
+                    if(w < 0 && errno == EINTR) continue;
+#ifndef _WIN32
+                    if(w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+                        struct pollfd out = {fd,POLLOUT,0};
+                        if(poll(&out,1,-1) >= 0 || errno == EINTR) continue;
+                    }
+#endif
+                    sent = false;
+                    forget_cursor();
+                    break;
+                }
+            }
+
+            // Update the counters
+            frame_bytes = size;
+            total_bytes += size;
+            frames++;
+            size = 0;
+            return sent;
+
+        }
+
+        // Getters/setters
+        void setOutput(int output){
+            fd = output;
+        }
+
+        int getOutput(){
+            return fd;
+        }
+
+        const char * getData(){
+            // The bytes of the frame that has not been flushed yet
+            return data;
+        }
+
+        int getSize(){
+            return size;
+        }
+
+        long getFrameBytes(){
+            return frame_bytes;
+        }
+
+        long getTotalBytes(){
+            return total_bytes;
+        }
+
+        long getFrames(){
+            return frames;
+        }
+
+};
+
+#endif
@@ -0,0 +1,179 @@
+#include <cstring>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#ifndef _glyphss
+#define _glyphss
+
+// Ramps of letters from the darkest to the brightest
+const char * RAMP_DEFAULT = " o0@";
+const char * RAMP_10 = " .:-=+*#%@";
+const char * RAMP_70 = " .'`^\",:;Il!i><~+_-?][}{1)(|\\/tfjrxnuvczXYUJCLQ0OZmwqpdbkhao*#MW&8%B@$";
+
+// Ways to spread the brightness between the levels of the ramp
+enum Dither { DITHER_NONE, DITHER_ORDERED, DITHER_FLOYD };
+
+class GlyphRamp{
+    // This class turns brightness (0-255) into letters of a ramp, for a whole frame at a time.
+    // Without dithering, a brightness v becomes the letter at floor(v*(levels-1)/255).
+    // Ordered dithering adds a 4x4 Bayer threshold before rounding down, so a brightness between
+    // two levels becomes a pattern of both. Floyd-Steinberg rounds to the nearest level and
+    // pushes the error onto the neighbours that come after.
+
+    private:
+
+        char ramp[256]; // The letters, darkest first
+        int levels; // How many letters the ramp has
+        char lut[256]; // The letter for every brightness, without dithering
+        unsigned short scale; // Multiplier so that (v*scale)>>16 is the level of v
+        unsigned short thresholds[4][4]; // Bayer thresholds as fractions of a level (out of 65536)
+        int * errors; // The two rows of errors of Floyd-Steinberg, kept between frames
+        int error_width; // The widest row the errors have space for
+
+    public:
+
+        GlyphRamp(const char * letters = RAMP_DEFAULT){
+            // Creates the ramp and precomputes the tables
+
+            errors = nullptr;
+            error_width = 0;
+            levels = std::min((int)strlen(letters),255);
+            if(levels < 1){
+                letters = " ";
+                levels = 1;
+            }
+            memcpy(ramp,letters,levels);
+            ramp[levels] = '\0';
+
+            // The multiplier is rounded up, which keeps floor(v*(levels-1)/255) exact for every v
+            scale = (unsigned short)(((levels-1)*65536+254)/255);
+            for(int v = 0; v < 256; v++)
+                lut[v] = ramp[(v*scale)>>16];
+
+            // The classic 4x4 Bayer matrix, thresholds in the middle of each of the 16 steps
+            const int bayer[4][4] = {{0,8,2,10},{12,4,14,6},{3,11,1,9},{15,7,13,5}};
+            for(int i = 0; i < 4; i++)
+                for(int j = 0; j < 4; j++)
+                    thresholds[i][j] = (unsigned short)(bayer[i][j]*4096+2048);
+
+        }
+
+        ~GlyphRamp(){
+            delete[] errors;
+        }
+
+        GlyphRamp(const GlyphRamp &) = delete;
+        GlyphRamp & operator=(const GlyphRamp &) = delete;
+
+        // Getters
+        const char * getRamp(){
+            return ramp;
+        }
+
+        int getLevels(){
+            return levels;
+        }
+
+        char getLetter(unsigned char brightness){
+            return lut[brightness];
+        }
+
+        void shade(const unsigned char * in, char * out, int width, int y0, int rows, int dither = DITHER_NONE){
+            // Shades rows of a frame, in and out point to the start of row y0 and hold rows*width cells
+            // y0 is only needed to line up the pattern of ordered dithering
+
+            if(dither == DITHER_FLOYD){
+                shade_floyd(in,out,width,rows);
+                return;
+            }
+
+            int n = width*rows;
+            if(dither == DITHER_NONE){
+                for(int i = 0; i < n; i++)
+                    out[i] = lut[in[i]];
+                return;
+            }
+
+            // Ordered, row by row so the thresholds line up
+            for(int r = 0; r < rows; r++)
+                shade_ordered(in+r*width,out+r*width,width,y0+r);
+
+        }
+
+    private:
+
+        void shade_ordered(const unsigned char * in, char * out, int width, int y){
+            // Ordered dithering of a row, the levels are found 8 cells at a time
+            // level = floor((v*scale+threshold)/65536), done with 16 bit lanes and a carry
+
+            unsigned char index[16];
+            const unsigned short * t = thresholds[y&3];
+            int x = 0;
+
+#if defined(__SSE2__)
+            __m128i s = _mm_set1_epi16((short)scale);
+            __m128i th = _mm_setr_epi16(t[0],t[1],t[2],t[3],t[0],t[1],t[2],t[3]);
+            __m128i sign = _mm_set1_epi16((short)0x8000);
+            __m128i zero = _mm_setzero_si128();
+            for(; x+8 <= width; x += 8){
+                __m128i v = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(in+x)),zero);
+                __m128i hi = _mm_mulhi_epu16(v,s);
+                __m128i lo = _mm_mullo_epi16(v,s);
+                __m128i sum = _mm_add_epi16(lo,th);
+                // There is a carry if the sum wrapped around (unsigned compare through the sign bit)
+                __m128i carry = _mm_cmpgt_epi16(_mm_xor_si128(lo,sign),_mm_xor_si128(sum,sign));
+                __m128i level = _mm_sub_epi16(hi,carry);
+                _mm_storel_epi64((__m128i *)index,_mm_packus_epi16(level,zero));
+                for(int k = 0; k < 8; k++)
+                    out[x+k] = ramp[index[k]];
+            }
+#endif
+
+            // The rest one at a time
+            for(; x < width; x++){
+                unsigned int level = (in[x]*scale+t[x&3])>>16;
+                out[x] = ramp[level];
+            }
+
+        }
+
+        void shade_floyd(const unsigned char * in, char * out, int width, int rows){
+            // Floyd-Steinberg dithering, every cell depends on the ones before it so this goes in order
+            // The values are kept in levels with 8 bits of fraction
+
+            // The rows of errors only grow, so a frame of the same width allocates nothing
+            if(width > error_width){
+                delete[] errors;
+                errors = new int[2*(width+2)];
+                error_width = width;
+            }
+            std::fill(errors,errors+2*(width+2),0);
+            int * current = errors+1, * next = errors+width+3;
+            int top = (levels-1)<<8;
+
+            for(int r = 0; r < rows; r++){
+                for(int x = 0; x < width; x++){
+                    int value = (in[r*width+x]*scale>>8)+current[x]/16;
+                    value = std::max(0,std::min(top,value));
+                    int level = (value+128)>>8;
+                    out[r*width+x] = ramp[level];
+
+                    // Spread what was lost
+                    int error = value-(level<<8);
+                    current[x+1] += error*7;
+                    next[x-1] += error*3;
+                    next[x] += error*5;
+                    next[x+1] += error;
+                }
+                std::swap(current,next);
+                std::fill(next-1,next+width+1,0);
+            }
+
+        }
+
+};
+
+#endif
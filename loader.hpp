@@ -0,0 +1,582 @@
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <climits>
+#include <vector>
+#include <thread>
+#include "mesh.hpp"
+#include "mapped.hpp"
+#include "threadpool.hpp"
+
+#ifndef _loaderh
+#define _loaderh
+
+// Loaders that make meshes out of model files, Wavefront OBJ and STL (binary or ASCII)
+// The file is mapped into memory and parsed in place, straight into the buffers of the mesh,
+// so the only memory they need besides the mesh is the file itself (and it stays in the page cache).
+// Meshes can also be saved to a binary mesh file, which is used right from the mapping next time.
+
+// The tokenizer, it works on ranges since the mapped file has no terminating zero
+// Every function moves p past what it read and never goes beyond end
+
+inline void skip_blanks(const char *& p, const char * end){
+    while(p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+}
+
+inline void skip_token(const char *& p, const char * end){
+    while(p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') p++;
+}
+
+inline bool parse_int(const char *& p, const char * end, long long & value){
+    // Reads an optionally signed whole number, false if there is none
+
+    skip_blanks(p,end);
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+    if(p >= end || *p < '0' || *p > '9') return false;
+    long long v = 0;
+    while(p < end && *p >= '0' && *p <= '9'){
+        if(v < LLONG_MAX/10) v = 10*v+(*p-'0');
+        p++;
+    }
+    value = negative?-v:v;
+    return true;
+
+}
+
+inline bool parse_float(const char *& p, const char * end, float & value){
+    // Reads a number like -1.25e-3, false if there is none
+    // The first 19 significant digits are kept, which is far more than a float holds
+
+    static const double powers[] = {1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,1e8,1e9,1e10,1e11,
+        1e12,1e13,1e14,1e15,1e16,1e17,1e18,1e19,1e20,1e21,1e22};
+
+    skip_blanks(p,end);
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+
+    // The digits go into a whole number and the decimal point into the exponent
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    bool any = false;
+    while(p < end && *p >= '0' && *p <= '9'){
+        if(digits < 19){
+            mantissa = 10*mantissa+(*p-'0');
+            if(mantissa) digits++;
+        }
+        else exponent++;
+        any = true;
+        p++;
+    }
+    if(p < end && *p == '.'){
+        p++;
+        while(p < end && *p >= '0' && *p <= '9'){
+            if(digits < 19){
+                mantissa = 10*mantissa+(*p-'0');
+                if(mantissa) digits++;
+                exponent--;
+            }
+            any = true;
+            p++;
+        }
+    }
+    if(!any) return false;
+
+    // The exponent part, if it has no digits it's not part of the number
+    if(p+1 < end && (*p == 'e' || *p == 'E')){
+        const char * q = p+1;
+        bool negative_exponent = false;
+        if(*q == '-' || *q == '+') negative_exponent = (*q++ == '-');
+        if(q < end && *q >= '0' && *q <= '9'){
+            int e = 0;
+            while(q < end && *q >= '0' && *q <= '9'){
+                if(e < 10000) e = 10*e+(*q-'0');
+                q++;
+            }
+            exponent += negative_exponent?-e:e;
+            p = q;
+        }
+    }
+
+    double v = (double)mantissa;
+    for(; exponent > 22; exponent -= 22) v *= 1e22;
+    for(; exponent < -22; exponent += 22) v /= 1e22;
+    v = (exponent < 0)?v/powers[-exponent]:v*powers[exponent];
+    value = (float)(negative?-v:v);
+    return true;
+
+}
+
+
+struct ObjChunk{
+    // A part of an OBJ file that starts at the beginning of a line and ends after one
+    const char * begin, * end;
+    long long vertex_no, triangle_no; // What it has, found by the first pass
+    long long first_vertex, first_triangle; // Where its vertices and triangles go in the mesh
+    bool failed; // Set if it has a broken line or a face with a vertex that doesn't exist
+};
+
+void obj_scan(ObjChunk & chunk, float * x, float * y, float * z, int * triangles, long long total_vertices){
+    // Goes over the lines of a chunk, only the vertices (v) and faces (f) matter
+    // Without buffers (nullptr) it only counts them, with the buffers of a mesh it puts them where the chunk says.
+    // The buffers are taken from the mesh once, before the threads start, since editX and the others mark it changed.
+    // Faces with more than three corners are split in a fan around the first one.
+
+    bool fill = x != nullptr;
+    long long vertex = chunk.first_vertex, triangle = chunk.first_triangle;
+    long long vertex_no = 0, triangle_no = 0;
+
+    const char * p = chunk.begin, * end = chunk.end;
+    while(p < end){
+
+        skip_blanks(p,end);
+        const char * line_end = (const char *)memchr(p,'\n',end-p);
+        if(!line_end) line_end = end;
+
+        if(line_end-p >= 2 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')){
+            // A vertex, anything after the position (w or a color) is left out
+            if(fill){
+                p += 2;
+                if(!parse_float(p,line_end,x[vertex]) || !parse_float(p,line_end,y[vertex]) ||
+                    !parse_float(p,line_end,z[vertex])){
+                    chunk.failed = true;
+                    return;
+                }
+                vertex++;
+            }
+            vertex_no++;
+        }
+        else if(line_end-p >= 2 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')){
+            // A face, every corner is v, v/vt, v//vn or v/vt/vn and only v is needed
+            p += 2;
+            int corners = 0;
+            long long first = 0, previous = 0;
+            while(true){
+                skip_blanks(p,line_end);
+                if(p >= line_end || *p == '#') break;
+                if(fill){
+                    // Counting starts from 1, negative numbers count back from the last vertex so far
+                    long long index;
+                    if(!parse_int(p,line_end,index) || index == 0){
+                        chunk.failed = true;
+                        return;
+                    }
+                    index = (index > 0)?index-1:vertex+index;
+                    if(index < 0 || index >= total_vertices){
+                        chunk.failed = true;
+                        return;
+                    }
+                    if(corners == 0) first = index;
+                    else if(corners >= 2){
+                        triangles[3*triangle] = (int)first;
+                        triangles[3*triangle+1] = (int)previous;
+                        triangles[3*triangle+2] = (int)index;
+                        triangle++;
+                    }
+                    previous = index;
+                }
+                skip_token(p,line_end);
+                corners++;
+            }
+            if(corners > 2) triangle_no += corners-2;
+        }
+
+        p = line_end+1;
+
+    }
+
+    chunk.vertex_no = vertex_no;
+    chunk.triangle_no = triangle_no;
+
+}
+
+Mesh * load_obj(const char * path, bool edges = true, int threads = 0){
+    // Loads the vertices and faces of a Wavefront OBJ file, nullptr if it can't be read or is broken
+    // Big files are parsed in parallel chunks by the given number of threads (0 for one per core).
+    // The file is read twice, once to count and once to fill, so nothing is stored in between.
+    // Set edges to false to skip finding the edges, if the mesh will only be filled
+
+    MappedFile file(path,true);
+    if(!file.isOpen()) return nullptr;
+    const char * data = file.data();
+    size_t size = file.size();
+
+    // Split the file in chunks on line breaks, a few per thread so they even out
+    if(threads <= 0) threads = std::max(1,(int)std::thread::hardware_concurrency());
+    const size_t chunk_size = 1<<20;
+    int chunk_no = (int)std::min<size_t>((size_t)threads*4,size/chunk_size+1);
+    std::vector<ObjChunk> chunks;
+    const char * start = data;
+    for(int i = 1; i <= chunk_no && start < data+size; i++){
+        const char * stop = data+size*i/chunk_no;
+        if(stop < start) stop = start;
+        if(i < chunk_no){
+            const char * line_end = (const char *)memchr(stop,'\n',data+size-stop);
+            stop = line_end?line_end+1:data+size;
+        }
+        chunks.push_back({start,stop,0,0,0,0,false});
+        start = stop;
+    }
+
+    ThreadPool * pool = (threads > 1 && chunks.size() > 1)?new ThreadPool(std::min(threads,(int)chunks.size())):nullptr;
+    auto run = [&](const std::function<void(int)> & job){
+        if(pool) pool->run(chunks.size(),job);
+        else for(size_t i = 0; i < chunks.size(); i++) job(i);
+    };
+
+    // Count, then give every chunk its place in the mesh
+    run([&](int i){ obj_scan(chunks[i],nullptr,nullptr,nullptr,nullptr,0); });
+    long long vertex_no = 0, triangle_no = 0;
+    for(ObjChunk & chunk : chunks){
+        chunk.first_vertex = vertex_no;
+        chunk.first_triangle = triangle_no;
+        vertex_no += chunk.vertex_no;
+        triangle_no += chunk.triangle_no;
+    }
+    if(vertex_no > INT_MAX/6 || triangle_no > INT_MAX/3){
+        delete pool;
+        return nullptr;
+    }
+
+    // Fill it
+    Mesh * mesh = new Mesh(vertex_no,triangle_no);
+    float * x = mesh->editX(), * y = mesh->editY(), * z = mesh->editZ();
+    int * triangles = mesh->editTriangles();
+    run([&](int i){ obj_scan(chunks[i],x,y,z,triangles,vertex_no); });
+    delete pool;
+    for(ObjChunk & chunk : chunks){
+        if(chunk.failed){
+            delete mesh;
+            return nullptr;
+        }
+    }
+
+    if(edges) mesh->build_edges();
+    return mesh;
+
+}
+
+
+class VertexWelder{
+    // Gives the same index to vertices at the same position, STL files repeat them for every triangle
+    // The positions are kept in a hash table with open addressing that grows when it's half full
+
+    private:
+
+        std::vector<float> positions; // x,y,z of every different vertex
+        std::vector<int> table; // Indices into the positions, -1 for empty places
+        size_t mask; // The size of the table minus one, it's always a power of two
+
+        static uint32_t bits(float v){
+            // The bits of a float, with -0 taken as 0 so they weld together
+            uint32_t b;
+            if(v == 0.0f) v = 0.0f;
+            memcpy(&b,&v,4);
+            return b;
+        }
+
+        static size_t hash(uint32_t a, uint32_t b, uint32_t c){
+            uint64_t h = a*0x9e3779b97f4a7c15ull;
+            h = (h^(h>>29)^b)*0xbf58476d1ce4e5b9ull;
+            h = (h^(h>>32)^c)*0x94d049bb133111ebull;
+            return (size_t)(h^(h>>31));
+        }
+
+        void grow(){
+            table.assign(2*table.size(),-1);
+            mask = table.size()-1;
+            for(size_t i = 0; i < positions.size()/3; i++){
+                const float * v = &positions[3*i];
+                size_t place = hash(bits(v[0]),bits(v[1]),bits(v[2]))&mask;
+                while(table[place] >= 0) place = (place+1)&mask;
+                table[place] = i;
+            }
+        }
+
+    public:
+
+        VertexWelder(size_t expected){
+            size_t capacity = 16;
+            while(capacity < 2*expected) capacity *= 2;
+            table.assign(capacity,-1);
+            mask = capacity-1;
+            positions.reserve(3*expected);
+        }
+
+        int add(float x, float y, float z){
+            // Returns the index of the vertex, a new one if nothing was at this position before
+
+            uint32_t bx = bits(x), by = bits(y), bz = bits(z);
+            size_t place = hash(bx,by,bz)&mask;
+            while(table[place] >= 0){
+                const float * v = &positions[3*table[place]];
+                if(bits(v[0]) == bx && bits(v[1]) == by && bits(v[2]) == bz) return table[place];
+                place = (place+1)&mask;
+            }
+
+            int index = positions.size()/3;
+            table[place] = index;
+            positions.push_back(x);
+            positions.push_back(y);
+            positions.push_back(z);
+            if(2*positions.size()/3 > table.size()) grow();
+            return index;
+        }
+
+        int getVertexNo(){
+            return positions.size()/3;
+        }
+
+        const float * getPositions(){
+            return positions.data();
+        }
+
+};
+
+Mesh * load_stl(const char * path, bool edges = true){
+    // Loads the triangles of an STL file, binary or ASCII, nullptr if it can't be read or is broken
+    // STL has no shared vertices so the ones at the same position are welded together.
+    // Set edges to false to skip finding the edges, if the mesh will only be filled
+
+    MappedFile file(path,true);
+    if(!file.isOpen()) return nullptr;
+    const char * data = file.data();
+    size_t size = file.size();
+
+    // A binary file is an 80 byte header, the number of triangles and 50 bytes for each of them
+    // An ASCII one starts with "solid", but so do some binary ones, so the size decides first
+    uint32_t count = 0;
+    if(size >= 84) memcpy(&count,data+80,4);
+    bool binary = size >= 84 && 84+50*(uint64_t)count == size;
+    if(!binary){
+        const char * p = data, * end = data+size;
+        while(p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++;
+        bool ascii = end-p >= 5 && memcmp(p,"solid",5) == 0;
+        if(!ascii) binary = size >= 84 && 84+50*(uint64_t)count <= size;
+        if(!ascii && !binary) return nullptr;
+    }
+
+    std::vector<int> triangles;
+    VertexWelder * welder;
+    if(binary){
+        if(count > INT_MAX/3) return nullptr;
+        welder = new VertexWelder(count/2+1);
+        triangles.resize(3*(size_t)count);
+        for(uint32_t t = 0; t < count; t++){
+            // The normal comes first and is left out, it can be found from the corners
+            const char * facet = data+84+50*(size_t)t;
+            float v[9];
+            memcpy(v,facet+12,sizeof(v));
+            for(int k = 0; k < 3; k++)
+                triangles[3*t+k] = welder->add(v[3*k],v[3*k+1],v[3*k+2]);
+        }
+    }
+    else{
+        // Only the vertex lines matter, every three of them make a triangle
+        welder = new VertexWelder(size/500+1);
+        triangles.reserve(size/80);
+        const char * p = data, * end = data+size;
+        while(p < end){
+            while(p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++;
+            const char * word = p;
+            skip_token(p,end);
+            if(p-word == 6 && memcmp(word,"vertex",6) == 0){
+                float x, y, z;
+                if(!parse_float(p,end,x) || !parse_float(p,end,y) || !parse_float(p,end,z) ||
+                    triangles.size() >= (size_t)INT_MAX){
+                    delete welder;
+                    return nullptr;
+                }
+                triangles.push_back(welder->add(x,y,z));
+            }
+        }
+        if(triangles.size()%3 != 0){
+            delete welder;
+            return nullptr;
+        }
+    }
+
+    // Copy it all into a mesh, if its buffers can be counted in an int (the mesh keeps six floats per vertex)
+    int vertex_no = welder->getVertexNo(), triangle_no = triangles.size()/3;
+    if(vertex_no > INT_MAX/6 || triangle_no > INT_MAX/3){
+        delete welder;
+        return nullptr;
+    }
+    Mesh * mesh = new Mesh(vertex_no,triangle_no);
+    float * x = mesh->editX(), * y = mesh->editY(), * z = mesh->editZ();
+    const float * positions = welder->getPositions();
+    for(int i = 0; i < vertex_no; i++){
+        x[i] = positions[3*i];
+        y[i] = positions[3*i+1];
+        z[i] = positions[3*i+2];
+    }
+    delete welder;
+    std::copy(triangles.begin(),triangles.end(),mesh->editTriangles());
+
+    if(edges) mesh->build_edges();
+    return mesh;
+
+}
+
+
+// The mesh file, a compact binary copy of a mesh that is mapped and drawn as it is
+// It's an aligned header, then x, y and z of all the vertices as floats, the triangles as
+// three ints each and optionally the edges and their triangles, every block starting at a multiple of 64.
+// The numbers are in the byte order of the machine that wrote the file, a file from another order is refused.
+
+const uint32_t MESH_FILE_VERSION = 1;
+
+enum MeshFileFlags{
+    MESH_FILE_BOUNDS = 1, // The box around the vertices is in the header
+    MESH_FILE_EDGES = 2 // The edge blocks are there
+};
+
+struct alignas(64) MeshFileHeader{
+    char magic[8]; // "ARTMESH" and a zero
+    uint32_t version; // MESH_FILE_VERSION when written
+    uint32_t byte_order; // 0x01020304 as the writer saw it
+    uint32_t flags; // A combination of the MeshFileFlags
+    uint32_t vertex_no, triangle_no, edge_no;
+    float bounds[6]; // Smallest x,y,z then largest x,y,z
+    uint64_t positions, triangles, edges, edge_faces; // Where the blocks start, in bytes from the start of the file
+    uint64_t size; // The size of the whole file
+};
+
+inline uint64_t mesh_file_align(uint64_t offset){
+    return (offset+63)&~(uint64_t)63;
+}
+
+bool save_mesh_file(Mesh * mesh, const char * path){
+    // Writes a mesh to a mesh file, with its edges if it has them, false if it can't
+
+    MeshFileHeader header;
+    memset(&header,0,sizeof(header));
+    memcpy(header.magic,"ARTMESH",8);
+    header.version = MESH_FILE_VERSION;
+    header.byte_order = 0x01020304;
+    header.vertex_no = mesh->getVertexNo();
+    header.triangle_no = mesh->getTriangleNo();
+    header.edge_no = mesh->getEdgeNo();
+    header.flags = MESH_FILE_BOUNDS|(header.edge_no?MESH_FILE_EDGES:0);
+    memcpy(header.bounds,mesh->getBounds(),sizeof(header.bounds));
+
+    // Place the blocks one after the other
+    header.positions = mesh_file_align(sizeof(header));
+    header.triangles = mesh_file_align(header.positions+12*(uint64_t)header.vertex_no);
+    uint64_t end = header.triangles+12*(uint64_t)header.triangle_no;
+    if(header.edge_no){
+        header.edges = mesh_file_align(end);
+        header.edge_faces = mesh_file_align(header.edges+8*(uint64_t)header.edge_no);
+        end = header.edge_faces+8*(uint64_t)header.edge_no;
+    }
+    header.size = end;
+
+    FILE * file = fopen(path,"wb");
+    if(!file) return false;
+    const char zeros[64] = {0};
+    uint64_t at = 0;
+    auto block = [&](uint64_t offset, const void * data, uint64_t bytes){
+        // Pads up to the block and writes it
+        bool ok = fwrite(zeros,1,offset-at,file) == offset-at && fwrite(data,1,bytes,file) == bytes;
+        at = offset+bytes;
+        return ok;
+    };
+    int n = header.vertex_no;
+    bool ok = block(0,&header,sizeof(header)) && block(header.positions,mesh->getX(),4*(uint64_t)n) &&
+        block(header.positions+4*(uint64_t)n,mesh->getY(),4*(uint64_t)n) &&
+        block(header.positions+8*(uint64_t)n,mesh->getZ(),4*(uint64_t)n) &&
+        block(header.triangles,mesh->getTriangles(),12*(uint64_t)header.triangle_no);
+    if(ok && header.edge_no)
+        ok = block(header.edges,mesh->getEdges(),8*(uint64_t)header.edge_no) &&
+            block(header.edge_faces,mesh->getEdgeFaces(),8*(uint64_t)header.edge_no);
+    ok = fclose(file) == 0 && ok;
+    if(!ok) remove(path);
+    return ok;
+
+}
+
+Mesh * load_mesh_file(const char * path, bool edges = true){
+    // Maps a mesh file and makes a mesh right on it, nullptr if it can't be read, doesn't fit or is broken
+    // Nothing is copied here, only the indices are read once to check that they stay in the mesh,
+    // the positions come in when the mesh is first drawn.
+    // The file stays mapped until the mesh is deleted.
+    // If the file has no edges and edges is set they are found and kept in memory.
+
+    MappedFile * file = new MappedFile(path);
+    MeshFileHeader header;
+    bool ok = file->isOpen() && file->size() >= sizeof(header);
+    if(ok){
+        memcpy(&header,file->data(),sizeof(header));
+        uint64_t n = header.vertex_no, t = header.triangle_no, e = header.edge_no;
+        auto fits = [&](uint64_t offset, uint64_t bytes){
+            return offset%64 == 0 && offset >= sizeof(header) && offset <= header.size && bytes <= header.size-offset;
+        };
+        ok = memcmp(header.magic,"ARTMESH",8) == 0 && header.version == MESH_FILE_VERSION &&
+            header.byte_order == 0x01020304 && header.size == file->size() &&
+            n <= INT_MAX/3 && t <= INT_MAX/3 && e <= INT_MAX/2 &&
+            fits(header.positions,12*n) && fits(header.triangles,12*t) &&
+            (!(header.flags&MESH_FILE_EDGES) || (fits(header.edges,8*e) && fits(header.edge_faces,8*e)));
+    }
+    if(!ok){
+        delete file;
+        return nullptr;
+    }
+
+    // Every index must be in the mesh, a broken file would otherwise be drawn from outside the mapping
+    // The edges need a triangle on their first side, the second one can be -1
+    const char * data = file->data();
+    bool has_edges = header.flags&MESH_FILE_EDGES;
+    auto below = [](const char * block, uint64_t n, uint32_t limit, int lowest){
+        const int * index = (const int *)block;
+        for(uint64_t i = 0; i < n; i++)
+            if(index[i] < lowest || index[i] >= (long long)limit) return false;
+        return true;
+    };
+    ok = below(data+header.triangles,3*(uint64_t)header.triangle_no,header.vertex_no,0);
+    if(ok && has_edges){
+        const int * faces = (const int *)(data+header.edge_faces);
+        ok = below(data+header.edges,2*(uint64_t)header.edge_no,header.vertex_no,0) &&
+            below(data+header.edge_faces,2*(uint64_t)header.edge_no,header.triangle_no,-1);
+        for(uint32_t i = 0; ok && i < header.edge_no; i++)
+            ok = faces[2*i] >= 0;
+    }
+    if(!ok){
+        delete file;
+        return nullptr;
+    }
+
+    MeshBuffers buffers;
+    buffers.vertex_no = header.vertex_no;
+    buffers.triangle_no = header.triangle_no;
+    buffers.x = (const float *)(data+header.positions);
+    buffers.y = buffers.x+header.vertex_no;
+    buffers.z = buffers.y+header.vertex_no;
+    buffers.triangles = (const int *)(data+header.triangles);
+    buffers.edge_no = has_edges?header.edge_no:0;
+    buffers.edges = has_edges?(const int *)(data+header.edges):nullptr;
+    buffers.edge_faces = has_edges?(const int *)(data+header.edge_faces):nullptr;
+    buffers.bounds = (header.flags&MESH_FILE_BOUNDS)?header.bounds:nullptr;
+
+    Mesh * mesh = new Mesh(buffers,file);
+    if(edges && !has_edges) mesh->build_edges();
+    return mesh;
+
+}
+
+Mesh * load_mesh(const char * path, bool edges = true, int threads = 0){
+    // Loads a model file by its extension, .obj, .stl or .amesh (a mesh file), nullptr if it can't
+    // The threads are used for OBJ files only
+
+    const char * dot = strrchr(path,'.');
+    if(!dot) return nullptr;
+    char extension[7] = {0};
+    for(int i = 0; i < 6 && dot[i+1]; i++)
+        extension[i] = (dot[i+1] >= 'A' && dot[i+1] <= 'Z')?dot[i+1]-'A'+'a':dot[i+1];
+    if(strcmp(extension,"obj") == 0) return load_obj(path,edges,threads);
+    if(strcmp(extension,"stl") == 0) return load_stl(path,edges);
+    if(strcmp(extension,"amesh") == 0) return load_mesh_file(path,edges);
+    return nullptr;
+
+}
+
+#endif
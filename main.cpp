@@ -1,7 +1,11 @@
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <cmath>
 #include "canvas.hpp"
+#include "scheduler.hpp"
+#include "target.hpp"
+#include "loader.hpp"
 
 #ifdef _WIN32
 #include <Windows.h>
@@ -10,105 +14,149 @@
 #endif
 
 
-Color * Canvas::drawcolor = nullptr;
+Color Canvas::drawcolor(1,1,1);
 
 
-int main(){
+class Demo : public Scene{
+    // The demo scene: a camera that orbits around three cubes
 
-    printf("Hello World!\n\n\n\n");
+    private:
+
+        Canvas * canvas;
+        Color white, grey, black;
+        double w = 0; // The angle of the camera
+        Transform * view; // The camera of the live demo, moved every frame
+        Mesh * cube; // A unit cube, shared by all the cubes of the scene, or a loaded model
+        Mat3x4 models[3]; // Where each cube is and how big it is
+        int grey_no = 2; // How many grey cubes there are, none when showing a model
+
+    public:
+
+        Demo(Canvas * canvas, Color white, Color grey, Color black, Mesh * model = nullptr)
+            : canvas(canvas), white(white), grey(grey), black(black){
+
+            // Every cube is the unit cube scaled to its size and moved to its smallest corner
+            Point c1(0,0,0), c2(1,1,1);
+            cube = model?model:mesh_cube(&c1,&c2);
+            models[0] = Mat3x4(matrix_scale(10,10,10));
+            models[1] = Mat3x4(matrix_translate(30,30,0)*matrix_scale(5,5,5));
+            models[2] = Mat3x4(matrix_translate(15,15,10)*matrix_scale(10,10,20));
+
+            // A model takes the place of all the cubes, scaled to fit where they were
+            if(model){
+                const float * box = model->getBounds();
+                double size = std::max({box[3]-box[0],box[4]-box[1],box[5]-box[2],1e-6f});
+                models[0] = Mat3x4(matrix_scale(35/size,35/size,35/size)*matrix_translate(-box[0],-box[1],-box[2]));
+                grey_no = 0;
+            }
+
+            // The camera is made once, with the offset to the middle of the canvas after it
+            Point position(80,0,30), direction(-1,0,-0.9);
+            view = transform_view_per(&position,&direction,100.0);
+            view->push(matrix_translate(50,10,0));
+
+        }
+
+        ~Demo(){
+            delete cube;
+            delete view;
+        }
 
-    // Create a canvas and a color
+        void update(double dt){
+            // Move the camera around at a steady speed
+            w += 0.5*dt;
+        }
+
+        void draw(Transform * camera){
+            // Draws the cubes as seen from the camera, on a clear canvas
+            canvas->draw_clear(black);
+            camera->push(matrix_translate(50,10,0));
+            canvas->draw_instances(cube,camera,models,1,white);
+            canvas->draw_instances(cube,camera,models+1,grey_no,grey);
+            camera->pop();
+        }
+
+        void render(double){
+            // The camera is drawn where the last update left it, at 60 updates per second
+            // it moves too little in between for the letters to show it
+
+            // Move the projection camera, only its view slots change (the offset after them stays)
+            Point viewpoint(80*cos(w),80*sin(w),30), viewdir(-cos(w),-sin(w),-0.9);
+            view_per(view,&viewpoint,&viewdir,100.0);
+
+            // Print the cubes, all of them are the same mesh
+            canvas->draw_instances(cube,view,models,1,white);
+            canvas->draw_instances(cube,view,models+1,grey_no,grey);
+            canvas->render();
+            canvas->draw_clear(black);
+        }
+
+};
+
+
+int main(int argc, char ** argv){
+
+    // Create a canvas and the colors
     Canvas * mycanvas = new Canvas(100,60);
-    Color * white = new Color(1,1,1);
-    Color * grey = new Color(0.5,0,0);
-    Color * black = new Color(0,0,0);
-    
-    // Paint the canvas using the color
-    mycanvas->draw_pixel(2,3,white);
-    mycanvas->draw_pixel(12,6,grey);
-    mycanvas->draw_pixel(5,9,white);
-    
-    // Create a static triangle of points
-    
+    Color white(1,1,1), grey(0.5,0.5,0.5), black(0,0,0);
+
+    // prog --model <file> ... shows an OBJ or STL model instead of the cubes
+    Mesh * model = nullptr;
+    if(argc >= 3 && strcmp(argv[1],"--model") == 0){
+        model = load_mesh(argv[2]);
+        if(!model){
+            fprintf(stderr,"Could not load the model %s\n",argv[2]);
+            return 1;
+        }
+        argc -= 2;
+        argv += 2;
+    }
 
+    // prog --colors <16|256> ... prints the letters in the colors of the terminal palette
+    if(argc >= 3 && strcmp(argv[1],"--colors") == 0){
+        mycanvas->setColorMode((atoi(argv[2]) == 16)?COLOR_16:COLOR_256);
+        argc -= 2;
+        argv += 2;
+    }
 
-    
-    while(true)
-    for(double w = 0; w < 8*2*M_PI; w+=0.001){
-        
-        // For every frame produce a new view direction and a new transform
-        /*Point * a = new Point(0,0,0), *b = new Point(10,10,0), *c = new Point(10,0,0);
-        Triangle * tri = new Triangle(a,b,c);
-        Point * viewdir = new Point(-1,-1,-1);
-        Point * viewpoint = new Point(20,20,20);
-        Transform * camera = transform_view_per(viewpoint,viewdir,10);
-
-        // Transform the triangle
-        tri->transform(camera);
-        */
-
-        Cube * cube = new Cube(new Point(0,0,0),new Point(10,10,10));
-        Cube * cube2 = new Cube(new Point(30,30,0),new Point(35,35,5));
-        Cube * cube3 = new Cube(new Point(15,15,10),new Point(25,25,30));
-
-        //Point * a = tri->getPoint(0);
-        //a->getMatrix()->print();
-
-        // Create a projection camera transform
-        Transform * camera = transform_view_per(
-            new Point(80*cos(w),80*sin(w),30),
-            new Point(-cos(w),-sin(w),-0.9),
-            100.0
-        );
-        //camera->add(matrix_rot_axis(.7,0));
-        //Transform * camera = new Transform();
-        //Matrix * m = matrix_per(10.0);
-        //camera->add(m);
-        camera->add(matrix_translate(50,10,0));
-
-        //m->print();
-
-
-
-        /*
-        Transform * rot = new Transform();
-        rot->add(matrix_translate(-15,-15,0));
-        rot->add(matrix_rot_axis(w,0));
-        rot->add(matrix_rot_axis(2.12456*w,1));
-        rot->add(matrix_rot_axis(1.5678*w,2));
-        rot->add(matrix_translate(15,15,0));
-        */
-
-
-        cube->transform(camera);
-        cube2->transform(camera);
-        cube3->transform(camera);
-        //a->transform_matrix(m);
-
-        //camera->print();
-        //tri->getPoint(0)->getMatrix()->print();
-
-
-
-        // Print the triangle
-        mycanvas->draw_cube(cube,white);
-        mycanvas->draw_cube(cube2,grey);
-        mycanvas->draw_cube(cube3,grey);
-        mycanvas->render();
-        mycanvas->draw_clear(black);
-        
-        // Delete the redundant stuff
-        delete cube;
-        delete camera;
-        //delete a,b,c;
-        //delete camera;
-        //delete viewdir;
-        //break;
-        usleep(1000);
+    // Batch mode: prog --frames <directory> [count] saves one orbit of the camera as images and text
+    if(argc >= 3 && strcmp(argv[1],"--frames") == 0){
+        int count = (argc >= 4)?atoi(argv[3]):120;
+        Demo * demo = new Demo(mycanvas,white,grey,black,model);
+        CameraPath path;
+        for(int k = 0; k <= 16; k++){
+            double a = 2*M_PI*k/16;
+            Point position(80*cos(a),80*sin(a),30), direction(-cos(a),-sin(a),-0.9);
+            path.add(&position,&direction);
+        }
+        int saved = render_path(mycanvas,&path,count,100.0,[&](Canvas *, Transform * camera){
+            demo->draw(camera);
+        },argv[2],EXPORT_PPM|EXPORT_TEXT);
+        if(saved < 0){
+            fprintf(stderr,"Could not write the frames to %s\n",argv[2]);
+            return 1;
+        }
+        printf("Saved %d frames to %s\n",saved,argv[2]);
+        return 0;
     }
 
-    
+    printf("Hello World!\n\n\n\n");
 
+    // prog --record <file> also saves the session as an asciicast
+    Recorder * recorder = nullptr;
+    if(argc >= 3 && strcmp(argv[1],"--record") == 0){
+        recorder = mycanvas->record(argv[2]);
+        if(!recorder) fprintf(stderr,"Could not record to %s\n",argv[2]);
+    }
+    
+    // Paint the canvas using the color
+    mycanvas->draw_pixel(2,3,white);
+    mycanvas->draw_pixel(12,6,grey);
+    mycanvas->draw_pixel(5,9,white);
 
+    // Run the demo, updating it 60 times and rendering it 30 times per second
+    Demo * demo = new Demo(mycanvas,white,grey,black,model);
+    RenderLoop loop(60,30);
+    loop.run(demo);
 
-}
\ No newline at end of file
+}
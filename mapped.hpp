@@ -0,0 +1,107 @@
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifndef _mappedh
+#define _mappedh
+
+class MappedFile{
+    // A whole file mapped read-only into memory, the system reads the pages in as they are touched
+    // Where mapping is not possible the file is read into a buffer instead
+
+    private:
+
+        const char * bytes; // The contents, nullptr for an empty file
+        size_t length; // How many bytes there are
+        bool mapped; // If the contents are mapped, otherwise they were read into a buffer
+        bool opened; // If the file could be read at all
+
+    public:
+
+        MappedFile(const char * path, bool sequential = false){
+            // Set sequential if the file will be read once from start to end
+
+            bytes = nullptr;
+            length = 0;
+            mapped = false;
+            opened = false;
+
+#ifndef _WIN32
+            // Map it if it's a regular file with something in it
+            int fd = open(path,O_RDONLY);
+            if(fd < 0) return;
+            struct stat info;
+            if(fstat(fd,&info) == 0 && S_ISREG(info.st_mode)){
+                if(info.st_size == 0) opened = true;
+                else{
+                    void * p = mmap(nullptr,info.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+                    if(p != MAP_FAILED){
+                        if(sequential) madvise(p,info.st_size,MADV_SEQUENTIAL);
+                        bytes = (const char *)p;
+                        length = info.st_size;
+                        mapped = true;
+                        opened = true;
+                    }
+                }
+            }
+            close(fd);
+            if(opened) return;
+#endif
+
+            // Otherwise read it all
+            FILE * file = fopen(path,"rb");
+            if(!file) return;
+            std::vector<char> buffer;
+            char block[65536];
+            size_t got;
+            while((got = fread(block,1,sizeof(block),file)) > 0)
+                buffer.insert(buffer.end(),block,block+got);
+            opened = !ferror(file);
+            fclose(file);
+            if(!opened || buffer.empty()) return;
+            char * copy = new char[buffer.size()];
+            memcpy(copy,buffer.data(),buffer.size());
+            bytes = copy;
+            length = buffer.size();
+
+        }
+
+        ~MappedFile(){
+#ifndef _WIN32
+            if(mapped){
+                munmap((void *)bytes,length);
+                return;
+            }
+#endif
+            delete[] bytes;
+        }
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile & operator=(const MappedFile &) = delete;
+
+        bool isOpen(){
+            return opened;
+        }
+
+        bool isMapped(){
+            return mapped;
+        }
+
+        const char * data(){
+            return bytes;
+        }
+
+        size_t size(){
+            return length;
+        }
+
+};
+
+#endif
@@ -0,0 +1,343 @@
+#include <cstdio>
+#include <algorithm>
+#include "space.hpp"
+#include "batch.hpp"
+#include "mapped.hpp"
+
+#ifndef _meshh
+#define _meshh
+
+struct MeshBuffers{
+    // Geometry that belongs to someone else, like a mapped mesh file, for a mesh to use as it is
+    int vertex_no, triangle_no, edge_no;
+    const float * x, * y, * z; // The vertex positions
+    const int * triangles; // Three vertex indices per triangle
+    const int * edges, * edge_faces; // Two vertex indices and two triangles per edge, nullptr if there are none
+    const float * bounds; // The box around the vertices, nullptr to find it when needed
+};
+
+class Mesh{
+    // This is a model made of shared vertices and triangles that index them
+    // The vertices are kept as structure of arrays so they can be transformed in one batch.
+    // A list of the unique edges is kept for drawing the wireframe, so each edge is drawn once.
+    // The geometry can also be borrowed from outside buffers, then only the screen positions are allocated.
+
+    private:
+
+        int vertex_no; // How many vertices the mesh has
+        int triangle_no; // How many triangles the mesh has
+        int edge_no; // How many unique edges the triangles have
+
+        float * x, * y, * z; // The vertex positions
+        float * sx, * sy, * sz; // The positions after the last transformation
+        int * triangles; // Three vertex indices per triangle
+        int * edges; // Two vertex indices per edge
+        int * edge_faces; // The two triangles of every edge, -1 if it only has one
+        float bounds[6]; // The box around the vertices, smallest x,y,z then largest x,y,z
+        bool bounds_dirty; // Set when a vertex moved since the box was found
+        Mat4 matrix; // The matrix of the last transformation, used for culling
+        Arena * arena; // Where the buffers live, nullptr for the heap
+        bool borrowed; // If the positions and the triangles are not ours (and can't be changed)
+        bool borrowed_edges; // If the edges are not ours
+        MappedFile * source; // The file the borrowed buffers are in, deleted with the mesh
+
+        template <typename T>
+        T * newArray(int n){
+            return arena?arena->make_array<T>(n):new T[n];
+        }
+
+    public:
+
+        Mesh(int vertices, int triangle_count, Arena * from = nullptr){
+            // Creates a mesh with space for the given vertices and triangles
+            // Everything starts at zero, use the setters to fill it
+            // If an arena is given the buffers are allocated from it
+
+            vertex_no = vertices;
+            triangle_no = triangle_count;
+            edge_no = 0;
+            arena = from;
+
+            // Allocate all the vertex arrays in one go
+            x = newArray<float>(6*vertices);
+            y = x+vertices;
+            z = y+vertices;
+            sx = z+vertices;
+            sy = sx+vertices;
+            sz = sy+vertices;
+            std::fill(x,x+6*vertices,0.0f);
+
+            triangles = newArray<int>(3*triangle_count);
+            std::fill(triangles,triangles+3*triangle_count,0);
+            edges = nullptr;
+            edge_faces = nullptr;
+            bounds_dirty = true;
+            matrix = matrix_id();
+            borrowed = borrowed_edges = false;
+            source = nullptr;
+
+        }
+
+        Mesh(const MeshBuffers & buffers, MappedFile * file = nullptr){
+            // Creates a mesh on buffers that are already filled, nothing is copied
+            // They must stay as they are while the mesh lives. If they are in a file,
+            // give the file here and it is closed when the mesh is deleted.
+
+            vertex_no = buffers.vertex_no;
+            triangle_no = buffers.triangle_no;
+            edge_no = buffers.edges?buffers.edge_no:0;
+            arena = nullptr;
+            borrowed = true;
+            borrowed_edges = buffers.edges != nullptr;
+            source = file;
+
+            x = (float *)buffers.x;
+            y = (float *)buffers.y;
+            z = (float *)buffers.z;
+            triangles = (int *)buffers.triangles;
+            edges = (int *)buffers.edges;
+            edge_faces = (int *)buffers.edge_faces;
+
+            // Only the screen positions are ours, they are written by every transformation
+            sx = new float[3*vertex_no];
+            sy = sx+vertex_no;
+            sz = sy+vertex_no;
+
+            bounds_dirty = buffers.bounds == nullptr;
+            if(!bounds_dirty) std::copy(buffers.bounds,buffers.bounds+6,bounds);
+            matrix = matrix_id();
+
+        }
+
+        ~Mesh(){
+
+            // Delete all the buffers, the ones in an arena are given back when it resets
+            if(arena) return;
+            delete[] (borrowed?sx:x);
+            if(!borrowed) delete[] triangles;
+            if(!borrowed_edges){
+                delete[] edges;
+                delete[] edge_faces;
+            }
+            delete source;
+
+        }
+
+        Mesh(const Mesh &) = delete;
+        Mesh & operator=(const Mesh &) = delete;
+
+        // Setters for the geometry, not for a mesh on borrowed buffers
+        void setVertex(int i, double vx, double vy, double vz){
+            x[i] = vx;
+            y[i] = vy;
+            z[i] = vz;
+            bounds_dirty = true;
+        }
+
+        void setTriangle(int t, int a, int b, int c){
+            triangles[3*t] = a;
+            triangles[3*t+1] = b;
+            triangles[3*t+2] = c;
+        }
+
+        void build_edges(){
+            // Finds the unique edges of the triangles and the triangles on both sides of each
+            // Call this after setting the triangles
+
+            // Every edge is packed as (smaller index, larger index) in a single number,
+            // next to the triangle it came from
+            struct Side{
+                long long key;
+                int triangle;
+                bool operator<(const Side & other) const{
+                    return key < other.key || (key == other.key && triangle < other.triangle);
+                }
+            };
+            Side * sides = newArray<Side>(3*triangle_no);
+            for(int t = 0; t < triangle_no; t++){
+                for(int k = 0; k < 3; k++){
+                    long long a = triangles[3*t+k], b = triangles[3*t+(k+1)%3];
+                    if(a > b) std::swap(a,b);
+                    sides[3*t+k].key = (a<<32)|b;
+                    sides[3*t+k].triangle = t;
+                }
+            }
+
+            // Sorting brings the sides of the same edge together
+            std::sort(sides,sides+3*triangle_no);
+            int unique_no = 0;
+            for(int i = 0; i < 3*triangle_no; i++)
+                if(i == 0 || sides[i].key != sides[i-1].key) unique_no++;
+
+            // Save them as pairs of indices, with the first two triangles of each
+            if(!arena && !borrowed_edges){
+                delete[] edges;
+                delete[] edge_faces;
+            }
+            borrowed_edges = false;
+            edges = newArray<int>(2*unique_no);
+            edge_faces = newArray<int>(2*unique_no);
+            edge_no = 0;
+            for(int i = 0; i < 3*triangle_no; i++){
+                if(i > 0 && sides[i].key == sides[i-1].key){
+                    if(edge_faces[2*edge_no-1] < 0) edge_faces[2*edge_no-1] = sides[i].triangle;
+                    continue;
+                }
+                edges[2*edge_no] = (int)(sides[i].key>>32);
+                edges[2*edge_no+1] = (int)(sides[i].key&0xffffffff);
+                edge_faces[2*edge_no] = sides[i].triangle;
+                edge_faces[2*edge_no+1] = -1;
+                edge_no++;
+            }
+            if(!arena) delete[] sides;
+
+        }
+
+        // Returns the box around the vertices (smallest x,y,z then largest x,y,z), found again only if they moved
+        const float * getBounds(){
+            if(bounds_dirty){
+                for(int k = 0; k < 3; k++){
+                    const float * v = (k == 0)?x:(k == 1)?y:z;
+                    bounds[k] = bounds[k+3] = vertex_no?v[0]:0.0f;
+                    for(int i = 1; i < vertex_no; i++){
+                        bounds[k] = std::min(bounds[k],v[i]);
+                        bounds[k+3] = std::max(bounds[k+3],v[i]);
+                    }
+                }
+                bounds_dirty = false;
+            }
+            return bounds;
+        }
+
+        // Transform all the vertices at once, the original positions are kept
+        void transform(const Mat4 & m){
+            matrix = m;
+            transform_points(matrix,x,y,z,sx,sy,sz,vertex_no);
+        }
+
+        void transform(Transform * trans){
+            transform(trans->getMatrix());
+        }
+
+        // The matrix of the last transformation
+        const Mat4 & getMatrix(){
+            return matrix;
+        }
+
+        // Getters for the sizes
+        int getVertexNo(){
+            return vertex_no;
+        }
+
+        int getTriangleNo(){
+            return triangle_no;
+        }
+
+        int getEdgeNo(){
+            return edge_no;
+        }
+
+        // Getters for the buffers
+        const float * getX(){
+            return x;
+        }
+
+        const float * getY(){
+            return y;
+        }
+
+        const float * getZ(){
+            return z;
+        }
+
+        const float * getScreenX(){
+            return sx;
+        }
+
+        const float * getScreenY(){
+            return sy;
+        }
+
+        const float * getScreenZ(){
+            return sz;
+        }
+
+        const int * getTriangles(){
+            return triangles;
+        }
+
+        const int * getEdges(){
+            return edges;
+        }
+
+        const int * getEdgeFaces(){
+            return edge_faces;
+        }
+
+        // Writable buffers, for loaders that fill a mesh in place instead of vertex by vertex
+        // Different threads may fill different parts of them at the same time.
+        // A mesh on borrowed buffers gives nullptr, they can't be changed.
+        float * editX(){
+            if(borrowed) return nullptr;
+            bounds_dirty = true;
+            return x;
+        }
+
+        float * editY(){
+            if(borrowed) return nullptr;
+            bounds_dirty = true;
+            return y;
+        }
+
+        float * editZ(){
+            if(borrowed) return nullptr;
+            bounds_dirty = true;
+            return z;
+        }
+
+        int * editTriangles(){
+            return borrowed?nullptr:triangles;
+        }
+
+        bool isBorrowed(){
+            return borrowed;
+        }
+
+};
+
+// Functions that create meshes of simple shapes
+Mesh * mesh_cube(Point * p1, Point * p2, Arena * arena = nullptr){
+    // This is a cube defined by two opposite corners
+    // It has 8 corners and 12 triangles, all wound counter-clockwise when seen from outside
+    // If an arena is given the mesh is allocated from it (and must not be deleted)
+
+    // Find the corners so that the first one is the smallest in every axis
+    double x1 = std::min(p1->getX(),p2->getX()), x2 = std::max(p1->getX(),p2->getX());
+    double y1 = std::min(p1->getY(),p2->getY()), y2 = std::max(p1->getY(),p2->getY());
+    double z1 = std::min(p1->getZ(),p2->getZ()), z2 = std::max(p1->getZ(),p2->getZ());
+
+    // Corner i takes the second x if bit 0 is set, the second y for bit 1 and the second z for bit 2
+    Mesh * mesh = arena?arena->make<Mesh>(8,12,arena):new Mesh(8,12);
+    for(int i = 0; i < 8; i++)
+        mesh->setVertex(i,(i&1)?x2:x1,(i&2)?y2:y1,(i&4)?z2:z1);
+
+    // Two triangles for every face
+    mesh->setTriangle(0,0,1,4); // y1
+    mesh->setTriangle(1,1,5,4);
+    mesh->setTriangle(2,2,6,3); // y2
+    mesh->setTriangle(3,3,6,7);
+    mesh->setTriangle(4,0,4,2); // x1
+    mesh->setTriangle(5,4,6,2);
+    mesh->setTriangle(6,1,3,5); // x2
+    mesh->setTriangle(7,5,3,7);
+    mesh->setTriangle(8,0,3,1); // z1
+    mesh->setTriangle(9,0,2,3);
+    mesh->setTriangle(10,4,5,7); // z2
+    mesh->setTriangle(11,4,7,6);
+
+    mesh->build_edges();
+    return mesh;
+
+}
+
+#endif
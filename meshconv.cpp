@@ -0,0 +1,37 @@
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include "loader.hpp"
+
+// Converts a model to a mesh file, which loads without any parsing
+// Usage: meshconv <model.obj|model.stl> <output.amesh> [--no-edges]
+// The edges are saved too unless --no-edges is given, they are needed for the wireframe
+
+
+int main(int argc, char ** argv){
+
+    if(argc < 3){
+        fprintf(stderr,"Usage: %s <model.obj|model.stl> <output.amesh> [--no-edges]\n",argv[0]);
+        return 2;
+    }
+    bool edges = !(argc >= 4 && strcmp(argv[3],"--no-edges") == 0);
+
+    auto start = std::chrono::steady_clock::now();
+    Mesh * mesh = load_mesh(argv[1],edges);
+    if(!mesh){
+        fprintf(stderr,"Could not load the model %s\n",argv[1]);
+        return 1;
+    }
+    if(!save_mesh_file(mesh,argv[2])){
+        fprintf(stderr,"Could not write %s\n",argv[2]);
+        delete mesh;
+        return 1;
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+
+    printf("%s: %d vertices, %d triangles, %d edges, converted in %.2f s\n",
+        argv[2],mesh->getVertexNo(),mesh->getTriangleNo(),mesh->getEdgeNo(),elapsed);
+    delete mesh;
+    return 0;
+
+}
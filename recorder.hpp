@@ -0,0 +1,186 @@
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#ifndef _recorderr
+#define _recorderr
+
+class Recorder{
+    // This class records the frames of a canvas to an asciicast v2 file, which asciinema can play.
+    // Every frame is stored as the bytes it sent to the terminal, so only what changed takes space,
+    // and frames where nothing changed are not stored at all. Every so often a keyframe is stored
+    // instead, which clears the screen and draws everything, with a marker so a player can seek to it.
+    // The file is written by a background thread, the canvas only adds lines to a buffer.
+
+    private:
+
+        FILE * file;
+        std::thread writer;
+        std::mutex lock;
+        std::condition_variable wake;
+        std::string queue; // Lines waiting for the writer
+        std::string line; // The lines of the frame being recorded, reused between frames
+        bool stopping;
+
+        double start; // When the recording started, on the monotonic clock
+        double keyframe_interval; // Most seconds between keyframes, while something changes
+        double last_keyframe; // When the last keyframe was stored
+        long deltas; // Frames stored since the last keyframe
+
+        // Counters
+        long frames; // Frames stored, keyframes included
+        long keyframes; // Keyframes stored
+        long bytes; // Bytes given to the writer
+
+        static double now(){
+            return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        static void append_json(std::string & out, const char * data, int size){
+            // Adds the bytes as a JSON string, escape codes become \u001b and so on
+            static const char hex[] = "0123456789abcdef";
+            out += '"';
+            for(int i = 0; i < size; i++){
+                unsigned char c = data[i];
+                if(c == '"' || c == '\\'){
+                    out += '\\';
+                    out += c;
+                }else if(c < 0x20){
+                    out += "\\u00";
+                    out += hex[c>>4];
+                    out += hex[c&15];
+                }else{
+                    out += c;
+                }
+            }
+            out += '"';
+        }
+
+        void write_loop(){
+            // Runs on the writer thread, takes everything in the queue and writes it at once
+            std::string chunk;
+            std::unique_lock<std::mutex> guard(lock);
+            while(true){
+                wake.wait(guard,[&]{ return stopping || !queue.empty(); });
+                if(queue.empty() && stopping) break;
+                chunk.swap(queue);
+                guard.unlock();
+                fwrite(chunk.data(),1,chunk.size(),file);
+                fflush(file); // So a session that gets killed keeps what it recorded
+                chunk.clear();
+                guard.lock();
+            }
+        }
+
+    public:
+
+        Recorder(const char * path, int columns, int rows, double keyframe_seconds = 10.0){
+            // Creates the file and starts the writer, columns and rows are the size of the terminal
+            // Canvas::record makes one of the right size
+
+            file = fopen(path,"wb");
+            stopping = false;
+            start = now();
+            keyframe_interval = keyframe_seconds;
+            last_keyframe = start;
+            deltas = 0;
+            frames = keyframes = bytes = 0;
+            if(!file) return;
+
+            // The header goes first
+            fprintf(file,"{\"version\": 2, \"width\": %d, \"height\": %d, \"timestamp\": %ld}\n",
+                columns,rows,(long)time(nullptr));
+            writer = std::thread(&Recorder::write_loop,this);
+
+        }
+
+        ~Recorder(){
+            close();
+        }
+
+        void close(){
+            // Writes what is left and closes the file, nothing is recorded after this
+            if(!file) return;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                stopping = true;
+            }
+            wake.notify_one();
+            writer.join();
+            fclose(file);
+            file = nullptr;
+        }
+
+        bool isOpen(){
+            return file != nullptr;
+        }
+
+        // Whether the next frame should be a keyframe: the first one, and then after the interval if something changed
+        bool keyframe_due(){
+            return file && (keyframes == 0 || (deltas > 0 && now()-last_keyframe >= keyframe_interval));
+        }
+
+        void record(const char * data, int size, bool keyframe){
+            // Stores the bytes of a frame, timed from the start of the recording
+
+            if(!file) return;
+            double t = now();
+
+            // Build the lines outside the lock, the marker comes first so seeking lands on the clear
+            line.clear();
+            char stamp[32];
+            snprintf(stamp,sizeof(stamp),"%.6f",t-start);
+            if(keyframe){
+                line += "[";
+                line += stamp;
+                line += ", \"m\", \"keyframe\"]\n";
+            }
+            line += "[";
+            line += stamp;
+            line += ", \"o\", ";
+            append_json(line,data,size);
+            line += "]\n";
+
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                queue += line;
+            }
+            wake.notify_one();
+
+            // Update the counters
+            frames++;
+            bytes += line.size();
+            if(keyframe){
+                keyframes++;
+                last_keyframe = t;
+                deltas = 0;
+            }else{
+                deltas++;
+            }
+
+        }
+
+        // Setters/getters
+        void setKeyframeInterval(double seconds){
+            keyframe_interval = seconds;
+        }
+
+        long getFrames(){
+            return frames;
+        }
+
+        long getKeyframes(){
+            return keyframes;
+        }
+
+        long getBytes(){
+            return bytes;
+        }
+
+};
+
+#endif
@@ -0,0 +1,156 @@
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+#ifndef _schedulerr
+#define _schedulerr
+
+class Scene{
+    // This is the interface for anything that the render loop drives
+    // update moves the scene forward by a fixed step of time,
+    // render draws it, alpha tells how far it is between the last update and the next (0 to 1)
+
+    public:
+
+        virtual ~Scene(){}
+
+        virtual void update(double dt) = 0;
+        virtual void render(double alpha) = 0;
+
+};
+
+class RenderLoop{
+    // This is a loop that updates a scene at a fixed rate and renders it at its own rate.
+    // Time is measured by a monotonic clock. If rendering falls behind, the missed frames are
+    // skipped instead of rendered late, and if updating falls behind, the extra time is dropped.
+    // Waiting is done by sleeping, except for the very end which is spun for accuracy.
+
+    private:
+
+        typedef std::chrono::steady_clock Clock;
+
+        double update_step; // Seconds between updates
+        double render_step; // Seconds between renders
+        int max_updates; // Most updates that can run between two renders
+        double spin_time; // Seconds before the deadline where sleeping turns into spinning
+        bool stopping;
+
+        // Counters
+        long updates; // Updates that ran
+        long frames; // Frames that were rendered
+        long skipped; // Frames that were skipped because the loop was late
+        double dropped; // Seconds of updates that were dropped because the loop was late
+
+        static double now(){
+            // The time in seconds on the monotonic clock
+            return std::chrono::duration<double>(Clock::now().time_since_epoch()).count();
+        }
+
+        void wait_until(double deadline){
+            // Sleeps for most of the time and spins for the rest
+
+            double left = deadline-now();
+            if(left > spin_time)
+                std::this_thread::sleep_for(std::chrono::duration<double>(left-spin_time));
+            while(now() < deadline)
+                std::this_thread::yield();
+
+        }
+
+    public:
+
+        RenderLoop(double update_rate = 60.0, double render_rate = 30.0){
+            // Creates the loop for the given rates (per second)
+            update_step = 1.0/update_rate;
+            render_step = 1.0/render_rate;
+            max_updates = 5;
+            spin_time = 0.002;
+            stopping = false;
+            updates = frames = skipped = 0;
+            dropped = 0.0;
+        }
+
+        void run(Scene * scene, double seconds = -1){
+            // Runs the scene until stop is called, or for the given seconds if they are not negative
+
+            stopping = false;
+            double start = now();
+            double last = start; // When the time was last accounted for
+            double lag = 0.0; // Time that has not been updated yet
+            double next_render = start;
+
+            while(!stopping){
+
+                double t = now();
+                if(seconds >= 0 && t-start >= seconds) break;
+
+                // Catch up the updates, up to a limit
+                lag += t-last;
+                last = t;
+                int steps = 0;
+                while(lag >= update_step && steps < max_updates){
+                    scene->update(update_step);
+                    lag -= update_step;
+                    steps++;
+                    updates++;
+                }
+
+                // If it is still behind, give up on the time it could not update
+                if(lag >= update_step){
+                    dropped += lag-update_step;
+                    lag = update_step*0.999;
+                }
+
+                // Render if it is time, skipping the frames that were missed
+                if(t >= next_render){
+                    scene->render(lag/update_step);
+                    frames++;
+                    next_render += render_step;
+                    if(next_render <= now()){
+                        long missed = (long)((now()-next_render)/render_step)+1;
+                        skipped += missed;
+                        next_render += missed*render_step;
+                    }
+                }
+
+                // Wait for whatever comes first
+                wait_until(std::min(next_render,last+update_step-lag));
+
+            }
+
+        }
+
+        void stop(){
+            // Makes run return after the current iteration, can be called from the scene
+            stopping = true;
+        }
+
+        // Setters
+        void setMaxUpdates(int n){
+            max_updates = (n > 1)?n:1;
+        }
+
+        void setSpinTime(double seconds){
+            spin_time = seconds;
+        }
+
+        // Getters for the counters
+        long getUpdates(){
+            return updates;
+        }
+
+        long getFrames(){
+            return frames;
+        }
+
+        long getSkipped(){
+            return skipped;
+        }
+
+        double getDropped(){
+            return dropped;
+        }
+
+};
+
+#endif
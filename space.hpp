@@ -1,206 +1,322 @@
 #include <cstdio>
 #include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+#include "arena.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #ifndef _spacee
 #define _spacee
 
-class Matrix{
-
-    // This is a representation of a mathematical 2d matrix 
-    // It is filled with doubles
-
-    private:
-
-        int rows, columns; // Rows and columns of the matrix
-        double ** array; // The actual values
-
-        void deleteArray(){
-            // This function will delete the array containing the values
-
-            for(int i = 0; i < rows; i++)
-                delete[] array[i];
-            delete[] array;
-
+struct Vec4{
 
-        }
-
-    public:
-
-        Matrix(int r, int c){
-            // This will create a zero matrix given the rows and columns
+    // This is a homogenous 4d vector stored by value
+    // It's used for points, so it is the same as a 4x1 matrix
 
-            // Set the rows and columns
-            rows = r;
-            columns = c;
-
-            // Create the values
-            array = new double *[r];
-            for(int i = 0; i < r; i++){
-                array[i] = new double[c];
-                for(int j = 0; j < c; j++)
-                    array[i][j] = 0.0;
-            }
+    double x, y, z, w;
 
+    constexpr Vec4(double x = 0, double y = 0, double z = 0, double w = 1) : x(x), y(y), z(z), w(w){}
 
-        }
+    // Access by index, 0 = x, 1 = y, 2 = z, 3 = w
+    constexpr double operator[](int i) const{
+        return (i == 0)?x:(i == 1)?y:(i == 2)?z:w;
+    }
 
-        ~Matrix(){
+    constexpr double & operator[](int i){
+        return (i == 0)?x:(i == 1)?y:(i == 2)?z:w;
+    }
 
-            // Delete the array of the values
-            deleteArray();
+    // For debugging
+    void print() const{
+        printf("[ %.2lf %.2lf %.2lf %.2lf ]\n",x,y,z,w);
+    }
 
-        }
-
-        // Getters/setters for element
-        double get(int r, int c){
-            return array[r][c];
-        }
-
-        void set(int r, int c, double value){
-            array[r][c] = value;
-        }
-
-        // Useful operations
-        void paste(Matrix * other){
-            // This function will paste a matrix to this one, will also change rows and columns to match
-
-            // Delete the old array
-            deleteArray();
-
-            // Copy the other data over
-            rows = other->rows;
-            columns = other->columns;
-            array = new double *[rows];
-            for(int i = 0; i < rows; i++){
-                array[i] = new double[columns];
-                for(int j = 0; j < columns; j++)
-                    array[i][j] = other->array[i][j];
-            }
+};
 
-        }
+template <int R, int C, typename T = double>
+struct Matrix{
+
+    // This is a representation of a mathematical 2d matrix, its size is known at compile time
+    // The values are stored by value in one block, row after row, and nothing here allocates.
+    // Operations between matrices of sizes that don't fit together do not compile.
+
+    static_assert(R > 0 && C > 0,"A matrix needs at least one row and one column");
+
+    T m[R][C]; // Row major values
+
+    constexpr Matrix() : m{}{
+        // Creates a zero matrix
+    }
+
+    static constexpr Matrix identity(){
+        static_assert(R == C,"Only square matrices have an identity");
+        Matrix mat;
+        for(int i = 0; i < R; i++)
+            mat.m[i][i] = 1;
+        return mat;
+    }
+
+    // Getters/setters for element
+    constexpr T get(int r, int c) const{
+        return m[r][c];
+    }
+
+    constexpr void set(int r, int c, T value){
+        m[r][c] = value;
+    }
+
+    // Mathematical operations
+    constexpr void add(const Matrix & other, T scale = 1){
+        // This will add another matrix to this one
+        // Scale will be applied to the added matrix before addition (it allows for subtraction)
+        for(int i = 0; i < R; i++)
+            for(int j = 0; j < C; j++)
+                m[i][j] += scale*other.m[i][j];
+    }
+
+    constexpr void mul(const Matrix<R,R,T> & other){
+        // This will perform matrix multiplication and save the result to this matrix
+        // It is assumed that the other matrix is on the left of the multiplication
+        *this = other*(*this);
+    }
+
+    // For debugging
+    void print() const{
+        printf("[ ");
+        for(int i = 0; i < R; i++){
+            for(int j = 0; j < C; j++)
+                printf("%.2lf ",(double)m[i][j]);
+            printf((i != R-1)?"\n":" ]\n");
+        }
+    }
 
+};
 
-        // Mathematical operations
-        void add(Matrix * other, double scale = 1.0){
-            // This will add another matrix to this one
-            // Scale will be applied to the added matrix before addition (it allows for subtraction)
+// This is the 4x4 matrix used for the homogenous transformations
+typedef Matrix<4,4,double> Mat4;
+
+// Kernels for the 4x4 products, written out with SSE so they are straight-line code without branches
+// Every value is summed in the same order as the plain loops, so the results are exactly the same
+#if defined(__SSE2__)
+inline void kernel_4x4(const double * a, const double * b, double * out, int columns){
+    // out = a*b, where b has 4 rows of 4 (or 1) columns. Every row of the result is a sum of the rows of b
+    // scaled by the values of the row of a, two columns per register
+
+    if(columns == 1){
+        // The columns of a are gathered from pairs of rows, then scaled by the values of b
+        __m128d r0 = _mm_loadu_pd(a), r1 = _mm_loadu_pd(a+4), r2 = _mm_loadu_pd(a+8), r3 = _mm_loadu_pd(a+12);
+        __m128d s0 = _mm_loadu_pd(a+2), s1 = _mm_loadu_pd(a+6), s2 = _mm_loadu_pd(a+10), s3 = _mm_loadu_pd(a+14);
+        __m128d x = _mm_set1_pd(b[0]), y = _mm_set1_pd(b[1]), z = _mm_set1_pd(b[2]), w = _mm_set1_pd(b[3]);
+        __m128d top = _mm_mul_pd(_mm_unpacklo_pd(r0,r1),x);
+        top = _mm_add_pd(top,_mm_mul_pd(_mm_unpackhi_pd(r0,r1),y));
+        top = _mm_add_pd(top,_mm_mul_pd(_mm_unpacklo_pd(s0,s1),z));
+        top = _mm_add_pd(top,_mm_mul_pd(_mm_unpackhi_pd(s0,s1),w));
+        __m128d bottom = _mm_mul_pd(_mm_unpacklo_pd(r2,r3),x);
+        bottom = _mm_add_pd(bottom,_mm_mul_pd(_mm_unpackhi_pd(r2,r3),y));
+        bottom = _mm_add_pd(bottom,_mm_mul_pd(_mm_unpacklo_pd(s2,s3),z));
+        bottom = _mm_add_pd(bottom,_mm_mul_pd(_mm_unpackhi_pd(s2,s3),w));
+        _mm_storeu_pd(out,top);
+        _mm_storeu_pd(out+2,bottom);
+        return;
+    }
+
+    __m128d b0 = _mm_loadu_pd(b), b1 = _mm_loadu_pd(b+4), b2 = _mm_loadu_pd(b+8), b3 = _mm_loadu_pd(b+12);
+    __m128d c0 = _mm_loadu_pd(b+2), c1 = _mm_loadu_pd(b+6), c2 = _mm_loadu_pd(b+10), c3 = _mm_loadu_pd(b+14);
+    auto row = [&](int i){
+        __m128d a0 = _mm_set1_pd(a[4*i]), a1 = _mm_set1_pd(a[4*i+1]), a2 = _mm_set1_pd(a[4*i+2]), a3 = _mm_set1_pd(a[4*i+3]);
+        __m128d lo = _mm_mul_pd(a0,b0), hi = _mm_mul_pd(a0,c0);
+        lo = _mm_add_pd(lo,_mm_mul_pd(a1,b1));
+        hi = _mm_add_pd(hi,_mm_mul_pd(a1,c1));
+        lo = _mm_add_pd(lo,_mm_mul_pd(a2,b2));
+        hi = _mm_add_pd(hi,_mm_mul_pd(a2,c2));
+        lo = _mm_add_pd(lo,_mm_mul_pd(a3,b3));
+        hi = _mm_add_pd(hi,_mm_mul_pd(a3,c3));
+        _mm_storeu_pd(out+4*i,lo);
+        _mm_storeu_pd(out+4*i+2,hi);
+    };
+    row(0);
+    row(1);
+    row(2);
+    row(3);
 
-            // Check same dimensions
-            if(rows != other->rows || columns != other->columns){
-                printf("Error, tried to add matrices of different dimensions");
-            }
+}
 
-            // Perform the addition
-            for(int i = 0; i < rows; i++){
-                for(int j = 0; j < columns; j++)
-                    array[i][j] += scale*other->array[i][j];
-            }
+inline void kernel_4x4(const float * a, const float * b, float * out, int columns){
+    // The same with floats, a whole row per register
+
+    if(columns == 1){
+        __m128 c0 = _mm_loadu_ps(a), c1 = _mm_loadu_ps(a+4), c2 = _mm_loadu_ps(a+8), c3 = _mm_loadu_ps(a+12);
+        _MM_TRANSPOSE4_PS(c0,c1,c2,c3);
+        __m128 v = _mm_mul_ps(c0,_mm_set1_ps(b[0]));
+        v = _mm_add_ps(v,_mm_mul_ps(c1,_mm_set1_ps(b[1])));
+        v = _mm_add_ps(v,_mm_mul_ps(c2,_mm_set1_ps(b[2])));
+        v = _mm_add_ps(v,_mm_mul_ps(c3,_mm_set1_ps(b[3])));
+        _mm_storeu_ps(out,v);
+        return;
+    }
+
+    __m128 b0 = _mm_loadu_ps(b), b1 = _mm_loadu_ps(b+4), b2 = _mm_loadu_ps(b+8), b3 = _mm_loadu_ps(b+12);
+    auto row = [&](int i){
+        __m128 v = _mm_mul_ps(_mm_set1_ps(a[4*i]),b0);
+        v = _mm_add_ps(v,_mm_mul_ps(_mm_set1_ps(a[4*i+1]),b1));
+        v = _mm_add_ps(v,_mm_mul_ps(_mm_set1_ps(a[4*i+2]),b2));
+        v = _mm_add_ps(v,_mm_mul_ps(_mm_set1_ps(a[4*i+3]),b3));
+        _mm_storeu_ps(out+4*i,v);
+    };
+    row(0);
+    row(1);
+    row(2);
+    row(3);
 
-        }
+}
+#endif
+
+// Multiplications, the sizes have to fit together
+// 4x4 times 4x4 or 4x1 of floats or doubles use the kernels above (outside of constant expressions)
+template <int R, int K, int K2, int C, typename T>
+constexpr Matrix<R,C,T> operator*(const Matrix<R,K,T> & a, const Matrix<K2,C,T> & b){
+    static_assert(K == K2,"The columns of the left matrix have to match the rows of the right one");
+    Matrix<R,C,T> res;
+#if defined(__SSE2__) && (defined(__GNUC__) || defined(__clang__))
+    if constexpr (R == 4 && K == 4 && (C == 4 || C == 1) && (std::is_same<T,float>::value || std::is_same<T,double>::value)){
+        if(!__builtin_is_constant_evaluated()){
+            kernel_4x4(&a.m[0][0],&b.m[0][0],&res.m[0][0],C);
+            return res;
+        }
+    }
+#endif
+    for(int i = 0; i < R; i++)
+        for(int j = 0; j < C; j++){
+            T sum = a.m[i][0]*b.m[0][j];
+            for(int k = 1; k < K; k++)
+                sum += a.m[i][k]*b.m[k][j];
+            res.m[i][j] = sum;
+        }
+    return res;
+}
 
-        void mul(Matrix * other){
-            // This will perform matrix multiplication and save the result to this matrix
-            // It is assumed that the other matrix is on the left of the multiplication
+template <int R, int C, typename T>
+constexpr Matrix<R,C,T> operator+(const Matrix<R,C,T> & a, const Matrix<R,C,T> & b){
+    Matrix<R,C,T> res = a;
+    res.add(b);
+    return res;
+}
 
-            // Check that the coordinates are correct
-            if(other->columns != rows){
-                printf("Tried to multiply matrices with wrong dimensions\n");
-                return;
-            }
+template <int R, int C, typename T>
+constexpr Matrix<R,C,T> operator-(const Matrix<R,C,T> & a, const Matrix<R,C,T> & b){
+    Matrix<R,C,T> res = a;
+    res.add(b,-1);
+    return res;
+}
 
-            // Create a new temporary matrix to store the values
-            Matrix * temp = new Matrix(other->rows,columns);
-            for(int i = 0; i < other->rows; i++){
-                for(int j = 0; j < columns; j++){
+inline Vec4 operator*(const Mat4 & a, const Vec4 & v){
+    // A point is the same as a 4x1 matrix
+    Matrix<4,1,double> column;
+    for(int i = 0; i < 4; i++)
+        column.m[i][0] = v[i];
+    column = a*column;
+    return Vec4(column.m[0][0],column.m[1][0],column.m[2][0],column.m[3][0]);
+}
 
-                    // Each element is the dot product of the raw of other and column of this
-                    double result = 0.0;
-                    for(int k = 0; k < rows; k++){
-                        result += other->array[i][k]*array[k][j];
-                    }
+struct Mat3x4{
 
-                    temp->array[i][j] = result;
+    // The top three rows of an affine 4x4 matrix, the last row is always 0 0 0 1
+    // This is the compact way to keep the model matrices of many instances of a mesh
 
-                }
-            }
+    double m[3][4]; // Row major values
 
-            // Finally copy the matrix over and delete it
-            paste(temp);
-            delete temp;
+    constexpr Mat3x4() : m{}{
+        // Creates a zero matrix
+    }
 
-        }
+    constexpr explicit Mat3x4(const Mat4 & a) : m{}{
+        // Keeps the top three rows of an affine matrix
+        for(int i = 0; i < 3; i++)
+            for(int j = 0; j < 4; j++)
+                m[i][j] = a.m[i][j];
+    }
 
-        // For debugging
-        void print(){
-            // Prints the matrix values
-            printf("[ ");
-            for(int i = 0; i < rows; i++){
-                for(int j = 0; j < columns; j++)
-                    printf("%.2lf ",array[i][j]);
-                printf((i != rows-1)?"\n":" ]\n");
-            }
-        }
+    constexpr Mat4 toMat4() const{
+        Mat4 mat = Mat4::identity();
+        for(int i = 0; i < 3; i++)
+            for(int j = 0; j < 4; j++)
+                mat.m[i][j] = m[i][j];
+        return mat;
+    }
 
 };
 
-//Various functions that produce the right matrices
-Matrix * matrix_id(int dimension){
-    // Creates an identity matrix of the right dimensions
-    
-    // Create it and return it
-    Matrix * mat = new Matrix(dimension,dimension);
-    for(int i = 0; i < dimension; i++)
-        mat->set(i,i,1.0);
-    return mat;
+constexpr Mat4 operator*(const Mat4 & a, const Mat3x4 & b){
+    // Same as a*b.toMat4(), without the multiplications by the last row
+    Mat4 res;
+    for(int i = 0; i < 4; i++){
+        for(int j = 0; j < 4; j++)
+            res.m[i][j] = a.m[i][0]*b.m[0][j]+a.m[i][1]*b.m[1][j]+a.m[i][2]*b.m[2][j];
+        res.m[i][3] += a.m[i][3];
+    }
+    return res;
+}
 
+//Various functions that produce the right matrices
+//They all assume that you want to create transformations of homogenous 3d coordinates
+//and return the matrix by value
+constexpr Mat4 matrix_id(){
+    // Creates a 4x4 identity matrix
+    return Mat4::identity();
 }
 
-//The rest of the functions assume that you want to create transformations of homogenous 3d coordinates
-Matrix * matrix_scale(double width, double height, double depth){
+constexpr Mat4 matrix_scale(double width, double height, double depth){
     // This will create a matrix that will scale a point according to the parameters
     
-    Matrix * mat = matrix_id(4);
-    mat->set(0,0,width);
-    mat->set(1,1,height);
-    mat->set(2,2,depth);
+    Mat4 mat = matrix_id();
+    mat.set(0,0,width);
+    mat.set(1,1,height);
+    mat.set(2,2,depth);
     return mat;
 
 }
 
-Matrix * matrix_translate(double x, double y, double z){
+constexpr Mat4 matrix_translate(double x, double y, double z){
     // This is a matrix that will move the object at the specified direction
 
-    Matrix * mat = matrix_id(4);
-    mat->set(0,3,x);
-    mat->set(1,3,y);
-    mat->set(2,3,z);
+    Mat4 mat = matrix_id();
+    mat.set(0,3,x);
+    mat.set(1,3,y);
+    mat.set(2,3,z);
     return mat;
 
 }
 
-Matrix * matrix_rot_axis(double theta, int axis){
+inline Mat4 matrix_rot_axis(double theta, int axis){
     // This will rotate the object around an axis
     // Axis goes like 0 = x, 1 = y, 2 = z
 
-    Matrix * mat = matrix_id(4);
+    Mat4 mat = matrix_id();
     double cth = cos(theta);
     double sth = sin(theta);
     int a1 = (1+axis)%3;
     int a2 = (2+axis)%3;
-    mat->set(a1,a1,cth);
-    mat->set(a1,a2,-sth);
-    mat->set(a2,a1,sth);
-    mat->set(a2,a2,cth);
+    mat.set(a1,a1,cth);
+    mat.set(a1,a2,-sth);
+    mat.set(a2,a1,sth);
+    mat.set(a2,a2,cth);
     return mat;
 
 }
 
-Matrix * matrix_per(double d){
+constexpr Mat4 matrix_per(double d){
     // Performs projection assuming camera is at (0,0) looking at -z
     // and d is the z of the projection surface that is parallel to xy
-    Matrix * mat = matrix_scale(d,d,d);
-    mat->set(3,2,1.0);
-    mat->set(3,3,0.0);
+    // After the divide z holds 1/distance from the camera, so it's larger for closer points
+    // (and still linear on the screen, which is what the z-buffer needs)
+    Mat4 mat = matrix_scale(d,d,0.0);
+    mat.set(2,3,-1.0);
+    mat.set(3,2,1.0);
+    mat.set(3,3,0.0);
     return mat;
 
 }
@@ -208,86 +324,128 @@ Matrix * matrix_per(double d){
 class Transform{
     // This class is a multiplication of matrices, while keeping the original ones
     // It's helpful for memory keeping and easier syntax
+    // The matrices are kept as a stack of slots, the first one is always there (the identity at the start).
+    // Every slot can be replaced, and the products of the slots up to each one are cached: when a slot
+    // changes only the products from it onward are found again, and only when the final matrix is asked for.
+    // So a scene can push the matrix of a child, draw it and pop it, without multiplying its parents again.
 
     private:
 
         int mat_no; // How many matrices are used in the transformation
         int mat_max; // How many matrices does the array have space for
-        Matrix ** mats; // The matrices used in the transformation
-        Matrix * final; // The final matrix of the transformation
+        Mat4 * mats; // The matrices used in the transformation
+        Mat4 * prefix; // prefix[i] is the product of the matrices up to i, the last one is the final matrix
+        int clean; // How many of the products are up to date
+        Arena * arena; // Where the array of matrices lives, nullptr for the heap
+
+        Mat4 * newMats(int n){
+            return arena?arena->make_array<Mat4>(n):new Mat4[n];
+        }
 
     public:
 
-        Transform(){
+        Transform(Arena * from = nullptr){
             // The constructor will initiate the transformation with an identity matrix
+            // If an arena is given the matrices are allocated from it
 
-            // Create the array of matrices
+            // Create the array of matrices, with the products after them
+            arena = from;
             mat_max = 8;
-            mats = new Matrix*[mat_max];
-            for(int i = 0; i < mat_max; i++)
-                mats[i] = nullptr;
-            mats[0] = matrix_id(4);
+            mats = newMats(2*mat_max);
+            prefix = mats+mat_max;
+            mats[0] = matrix_id();
+            prefix[0] = matrix_id();
             mat_no = 1;
-
-            // Create the final matrix
-            final = matrix_id(4);
+            clean = 1;
 
 
         }
 
         ~Transform(){
 
-            // Delete all the matrices of the array
-            for(int i = 0; i < mat_no; i++)
-                delete mats[i];
-            delete[] mats;
-
-            // Delete the final matrix
-            delete final;
+            // Delete the array of the matrices
+            if(!arena) delete[] mats;
 
         }
 
-        void add(Matrix * matrix){
-            //Adds a new matrix to the transformation
+        Transform(const Transform &) = delete;
+        Transform & operator=(const Transform &) = delete;
+
+        int push(const Mat4 & matrix){
+            // Adds a new matrix to the transformation, applied after the others, and returns its slot
 
             // Check if you need to expand the array
             if(mat_no == mat_max){
                 //Expand
-                Matrix ** newmat = new Matrix*[mat_max*2];
-                for(int i = 0; i < mat_max*2; i++)
-                    newmat[i] = (i < mat_max)?mats[i]:nullptr;
-                delete[] mats;
+                Mat4 * newmat = newMats(4*mat_max);
+                for(int i = 0; i < mat_max; i++){
+                    newmat[i] = mats[i];
+                    newmat[2*mat_max+i] = prefix[i];
+                }
+                if(!arena) delete[] mats;
 
                 // Replace
                 mats = newmat;
                 mat_max *= 2;
+                prefix = mats+mat_max;
 
             }
 
-            // Add the new matrix to the array
-            mats[mat_no++] = matrix;
+            // Add the new matrix to the array, its product is found when it's needed
+            mats[mat_no] = matrix;
+            return mat_no++;
 
-            // Multiply the final so you get the correct result
-            final->mul(matrix);
+        }
 
+        void add(const Mat4 & matrix){
+            //Adds a new matrix to the transformation
+            push(matrix);
         }
 
-        Matrix * getMiniMatrix(int i){
+        void pop(int count = 1){
+            // Removes the last matrices, the first one always stays
+            mat_no = std::max(mat_no-count,1);
+            clean = std::min(clean,mat_no);
+        }
+
+        void set(int slot, const Mat4 & matrix){
+            // Replaces the matrix of a slot, the products after it are found again when needed
+            // Setting the same matrix again changes nothing
+            // A slot past the last one grows the stack up to it, the slots in between are identities
+            if(slot < 0) return;
+            if(slot >= mat_no){
+                while(mat_no < slot) push(matrix_id());
+                push(matrix);
+                return;
+            }
+            if(memcmp(&mats[slot],&matrix,sizeof(Mat4)) == 0) return;
+            mats[slot] = matrix;
+            clean = std::min(clean,slot);
+        }
+
+        int getSlotNo(){
+            return mat_no;
+        }
+
+        const Mat4 & getMiniMatrix(int i){
             return mats[i];
         }
 
-        Matrix * getMatrix(){
+        const Mat4 & getMatrix(){
             // Returns the final matrix used for the calculation
-            return final;
+            // Only the products after the first slot that changed are multiplied again
+            for(; clean < mat_no; clean++)
+                prefix[clean] = (clean == 0)?mats[0]:mats[clean]*prefix[clean-1];
+            return prefix[mat_no-1];
         }
 
         //For debugging
         void print(){
             // Print all the matrices and the final one
             for(int i = 0; i < mat_no; i++){
-                mats[i]->print();
+                mats[i].print();
             }
-            final->print();
+            getMatrix().print();
 
 
         }
@@ -301,36 +459,21 @@ class Point{
 
     private:
 
-        Matrix * coords; // Matrix that saves the coords
+        Vec4 coords; // Homogenous coords, stored by value
 
     public:
 
-        Point(double x = 0, double y = 0, double z = 0){
+        constexpr Point(double x = 0, double y = 0, double z = 0) : coords(x,y,z,1.0){
             // Creates the point with the given coordinates
-
-            // Construct the matrix
-            coords = new Matrix(4,1);
-            coords->set(0,0,x);
-            coords->set(1,0,y);
-            coords->set(2,0,z);
-            coords->set(3,0,1.0);
-
         }
 
-        ~Point(){
-
-            // Delete the coords matrix
-            delete coords;
-
-        }
-
-        Matrix * getMatrix(){
+        const Vec4 & getCoords(){
             return coords;
         }
 
         // Getters for the actual coords
         double get(int i){
-            return coords->get(i,0)/coords->get(3,0);
+            return coords[i]/coords.w;
         }
 
         double getX(){
@@ -345,6 +488,11 @@ class Point{
             return get(2);
         }
 
+        // The homogenous coord, after a projection it holds the depth in front of the camera (negative in front)
+        double getW(){
+            return coords.w;
+        }
+
         double getLength(){
             // Returns the length of the point/vector
             double x = getX();
@@ -361,16 +509,13 @@ class Point{
 
         }
 
-        void transform_matrix(Matrix * mat){
+        void transform_matrix(const Mat4 & mat){
             //Performs the transformation with only one matrix
 
             // Multiply the coords with the transformation matrix
-            coords->mul(mat);
-
-            // Then divide with the homogenous coord
-            for(int i = 0; i < 3; i++)
-                coords->set(i,0,coords->get(i,0)/coords->get(3,0));
-            coords->set(3,0,1.0);
+            // The homogenous coord is kept, the getters divide by it, so a point
+            // behind the camera can still be clipped before it is divided
+            coords = mat*coords;
 
         }
 
@@ -383,7 +528,8 @@ class Point{
 
             // Divide the coordinates by the length
             for(int i = 0; i < 3; i++)
-                coords->set(i,i,coords->get(i,i)/len);
+                coords[i] = get(i)/len;
+            coords.w = 1.0;
 
         }
 
@@ -411,32 +557,34 @@ class Triangle{
     
     private:
 
-        Point * points[3];
+        Point points[3]; // The points are kept by value
+        Mat4 matrix; // All the transformations applied to the points, used to tell if they were projected
 
     public:
 
-        Triangle(Point * p1, Point *p2, Point *p3){
+        constexpr Triangle(const Point & p1, const Point & p2, const Point & p3) : points{p1,p2,p3}, matrix(matrix_id()){
             // This will create a triange based off the given points
-
-            // Add the points to the array
-            points[0] = p1;
-            points[1] = p2;
-            points[2] = p3;
-
         }
 
         // Getter for the points
         Point * getPoint(int index){
-            return points[index];
+            return &points[index];
+        }
+
+        // The product of the transformations applied so far
+        const Mat4 & getMatrix(){
+            return matrix;
         }
 
         // Function for applying transformations
         void transform(Transform * trans){
             
             // Apply the transformation to all the points
+            const Mat4 & mat = trans->getMatrix();
             for(int i = 0; i < 3; i++){
-                points[i]->transform(trans);
+                points[i].transform_matrix(mat);
             }
+            matrix = mat*matrix;
 
         }
 
@@ -444,15 +592,16 @@ class Triangle{
 
             //Apply transformations showing the points as you go
             for(int i = 0; i < 6; i++){
-                Matrix * tr = trans->getMiniMatrix(i);
+                const Mat4 & tr = trans->getMiniMatrix(i);
                 if(i == 0)
                 for(int j = 0; j < 3; j++)
-                    points[j]->getMatrix()->print();
-                tr->print();
+                    points[j].getCoords().print();
+                tr.print();
                 for(int j = 0; j < 3; j++){
-                    points[j]->transform_matrix(tr);
-                    points[j]->getMatrix()->print();
+                    points[j].transform_matrix(tr);
+                    points[j].getCoords().print();
                 }
+                matrix = tr*matrix;
             }
         }
 
@@ -460,101 +609,46 @@ class Triangle{
 };
 
 // Function for complex transforms
-Transform * transform_view_per(Point * viewpoint, Point * viewdirection, double d){
-    // This function will create a perspective view transformation
-    // viewpoint is the point the camera resides in
-    // viewdirection is the directional vector that the camera looks by
-    // d is the distance of the projection surface from the camera.
-
-    //Initiate the transformation
-    Transform * trans = new Transform();
+void view_per(Transform * trans, Point * viewpoint, Point * viewdirection, double d){
+    // Sets the slots 1 to 5 of a transformation made by transform_view_per to a new view
+    // Nothing is allocated, and only the slots that changed (and the ones after them) are multiplied again,
+    // so moving a camera every frame costs a few multiplications instead of a new transformation
 
     // First move the viewpoint to (0,0)
     double vx = viewpoint->getX();
     double vy = viewpoint->getY();
     double vz = viewpoint->getZ();
-    trans->add(matrix_translate(-vx,-vy,-vz));
+    trans->set(1,matrix_translate(-vx,-vy,-vz));
 
     // Then set the direction to be looking at -z
     double theta = viewdirection->getTheta();
     double phi = viewdirection->getPhi();
     //printf("phi = %lf\n",phi);
-    trans->add(matrix_rot_axis(-phi,2));
-    trans->add(matrix_rot_axis(M_PI-theta,1));
-    trans->add(matrix_rot_axis(-M_PI/2.0,2));
+    trans->set(2,matrix_rot_axis(-phi,2));
+    trans->set(3,matrix_rot_axis(M_PI-theta,1));
+    trans->set(4,matrix_rot_axis(-M_PI/2.0,2));
 
     // Finally apply the perspective projection matrix
-    trans->add(matrix_per(d));
-    return trans;
+    trans->set(5,matrix_per(d));
 
 }
 
+Transform * transform_view_per(Point * viewpoint, Point * viewdirection, double d, Arena * arena = nullptr){
+    // This function will create a perspective view transformation
+    // viewpoint is the point the camera resides in
+    // viewdirection is the directional vector that the camera looks by
+    // d is the distance of the projection surface from the camera.
+    // If an arena is given the transformation is allocated from it (and must not be deleted)
+    // Use view_per to move the camera afterwards, more matrices can be pushed after the view
+
+    //Initiate the transformation, with the five slots of the view
+    Transform * trans = arena?arena->make<Transform>(arena):new Transform();
+    for(int i = 0; i < 5; i++)
+        trans->push(matrix_id());
+    view_per(trans,viewpoint,viewdirection,d);
+    return trans;
 
-//Some other shapes for testing
-class Cube{
-    // This is a cube defined by two points. It consists of triangles.
-
-    private:
-
-        Triangle * triangles[12];
-
-    public:
-
-        Cube(Point * p1, Point * p2){
-
-            // Find all the given coordinates
-            double x1 = p1->getX();
-            double y1 = p1->getY();
-            double z1 = p1->getZ();
-            double x2 = p2->getX();
-            double y2 = p2->getY();
-            double z2 = p2->getZ();
-
-            // Set all the triangles according to the points
-            triangles[0] = new Triangle(new Point(x1,y1,z1),new Point(x1,y1,z2),new Point(x2,y1,z1));
-            triangles[1] = new Triangle(new Point(x1,y1,z2),new Point(x2,y1,z2),new Point(x2,y1,z1));
-            triangles[2] = new Triangle(new Point(x1,y2,z1),new Point(x1,y2,z2),new Point(x2,y2,z1));
-            triangles[3] = new Triangle(new Point(x1,y2,z2),new Point(x2,y2,z2),new Point(x2,y2,z1));
-
-            triangles[4] = new Triangle(new Point(x1,y1,z1),new Point(x1,y1,z2),new Point(x1,y2,z1));
-            triangles[5] = new Triangle(new Point(x1,y1,z2),new Point(x1,y2,z2),new Point(x1,y2,z1));
-            triangles[6] = new Triangle(new Point(x2,y1,z1),new Point(x2,y1,z2),new Point(x2,y2,z1));
-            triangles[7] = new Triangle(new Point(x2,y1,z2),new Point(x2,y2,z2),new Point(x2,y2,z1));
-
-            triangles[8] = new Triangle(new Point(x1,y1,z2),new Point(x1,y2,z2),new Point(x2,y2,z2));
-            triangles[9] = new Triangle(new Point(x1,y1,z2),new Point(x2,y2,z2),new Point(x1,y2,z2));
-            triangles[10] = new Triangle(new Point(x1,y1,z1),new Point(x1,y2,z1),new Point(x2,y2,z1));
-            triangles[11] = new Triangle(new Point(x1,y1,z1),new Point(x2,y2,z1),new Point(x1,y2,z1));
-
-
-        }
-
-        ~Cube(){
-
-            // Delete all the triangles
-            for(int i = 0; i < 12; i++)
-                delete triangles[i];
-
-        }
-
-        // Get a specific triangle
-        Triangle * getTriangle(int i){
-            return triangles[i];
-        }
-
-        // Transform the cube
-        void transform(Transform * trans){
-
-            // Apply the transform to the triangles
-            for(int i = 0; i < 12; i++)
-                triangles[i]->transform(trans);
-
-        }
-
-
-
-};
-
+}
 
 
 #endif
\ No newline at end of file
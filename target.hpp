@@ -0,0 +1,154 @@
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <functional>
+#include <sys/stat.h>
+#include "canvas.hpp"
+
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+#ifndef _targett
+#define _targett
+
+// Formats for the frames saved by render_path, can be combined with |
+enum ExportFormat { EXPORT_PPM = 1, EXPORT_PGM = 2, EXPORT_TEXT = 4 };
+
+// Functions that save a frame to a file, they return false if the file could not be written
+// Every file is built in memory first and written with a single call
+bool write_file(const char * path, const char * data, size_t size){
+    FILE * f = fopen(path,"wb");
+    if(!f) return false;
+    bool ok = fwrite(data,1,size,f) == size;
+    return (fclose(f) == 0) && ok;
+}
+
+bool write_ppm(const char * path, const unsigned char * rgb, int width, int height){
+    // A binary PPM (P6), three bytes per pixel, the top row first
+    std::vector<char> data(32+3*width*height);
+    int header = sprintf(data.data(),"P6\n%d %d\n255\n",width,height);
+    memcpy(data.data()+header,rgb,3*width*height);
+    return write_file(path,data.data(),header+3*width*height);
+}
+
+bool write_pgm(const char * path, const unsigned char * grey, int width, int height){
+    // A binary PGM (P5), one byte per pixel, the top row first
+    std::vector<char> data(32+width*height);
+    int header = sprintf(data.data(),"P5\n%d %d\n255\n",width,height);
+    memcpy(data.data()+header,grey,width*height);
+    return write_file(path,data.data(),header+width*height);
+}
+
+bool write_text(const char * path, const char * letters, int width, int height){
+    // Plain text, every letter twice like on the terminal and a newline after every row
+    std::vector<char> data((2*width+1)*height);
+    char * out = data.data();
+    for(int y = 0; y < height; y++){
+        for(int x = 0; x < width; x++){
+            *out++ = letters[y*width+x];
+            *out++ = letters[y*width+x];
+        }
+        *out++ = '\n';
+    }
+    return write_file(path,data.data(),data.size());
+}
+
+bool export_frame(Canvas * canvas, const char * path, int format){
+    // Saves the last rendered frame of the canvas in one format, see Canvas::render_offscreen
+    int w = canvas->getWidth(), h = canvas->getHeight();
+    if(format == EXPORT_TEXT){
+        std::vector<char> letters(w*h);
+        canvas->copy_letters(letters.data());
+        return write_text(path,letters.data(),w,h);
+    }
+    std::vector<unsigned char> pixels(3*w*h);
+    if(format == EXPORT_PGM){
+        canvas->copy_brightness(pixels.data());
+        return write_pgm(path,pixels.data(),w,h);
+    }
+    canvas->copy_rgb(pixels.data());
+    return write_ppm(path,pixels.data(),w,h);
+}
+
+
+class CameraPath{
+    // This is a path for the camera made of keys, each a position and a view direction
+    // The camera moves between the keys in straight lines, at an even pace per key
+
+    private:
+
+        std::vector<Vec4> positions;
+        std::vector<Vec4> directions;
+
+    public:
+
+        void add(Point * position, Point * direction){
+            positions.push_back(position->getCoords());
+            directions.push_back(direction->getCoords());
+        }
+
+        int getKeyNo(){
+            return positions.size();
+        }
+
+        Transform * camera(double t, double d, Arena * arena = nullptr){
+            // Returns the camera at t, from 0 (the first key) to 1 (the last key)
+            // d is the distance of the projection plane, like in transform_view_per
+
+            int n = positions.size();
+            if(n == 0) return nullptr;
+            double at = std::max(0.0,std::min(1.0,t))*(n-1);
+            int k = std::min((int)at,std::max(n-2,0));
+            double f = (n > 1)?at-k:0.0;
+            const Vec4 & p1 = positions[k], & p2 = positions[std::min(k+1,n-1)];
+            const Vec4 & d1 = directions[k], & d2 = directions[std::min(k+1,n-1)];
+
+            Point position(p1.x+(p2.x-p1.x)*f,p1.y+(p2.y-p1.y)*f,p1.z+(p2.z-p1.z)*f);
+            Point direction(d1.x+(d2.x-d1.x)*f,d1.y+(d2.y-d1.y)*f,d1.z+(d2.z-d1.z)*f);
+            return transform_view_per(&position,&direction,d,arena);
+
+        }
+
+};
+
+int render_path(Canvas * canvas, CameraPath * path, int frames, double d,
+    const std::function<void(Canvas *, Transform *)> & draw, const char * directory, int formats = EXPORT_PPM){
+    // Renders frames along the camera path straight to files, without touching the terminal
+    // draw is called with the camera of every frame and should draw the whole scene (clearing first).
+    // The files are called frame_00000.ppm and so on, in the directory, which is made if it is missing.
+    // Returns how many frames were saved, or -1 if a file could not be written
+
+#ifdef _WIN32
+    _mkdir(directory);
+#else
+    mkdir(directory,0755);
+#endif
+
+    static const char * extensions[3] = {"ppm","pgm","txt"};
+    Arena arena; // The cameras, given back after every frame
+    std::string name;
+    for(int i = 0; i < frames; i++){
+
+        Transform * camera = path->camera((frames > 1)?(double)i/(frames-1):0.0,d,&arena);
+        draw(canvas,camera);
+        canvas->render_offscreen();
+
+        // Save every format that was asked for
+        for(int k = 0; k < 3; k++){
+            if(!(formats&(1<<k))) continue;
+            char file[32];
+            snprintf(file,sizeof(file),"frame_%05d.%s",i,extensions[k]);
+            name = std::string(directory)+"/"+file;
+            if(!export_frame(canvas,name.c_str(),1<<k)) return -1;
+        }
+
+        arena.reset();
+    }
+
+    return frames;
+
+}
+
+#endif
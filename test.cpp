@@ -0,0 +1,1267 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdarg>
+#include <cstdlib>
+#include <csignal>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "canvas.hpp"
+#include "loader.hpp"
+
+// Checks of the drawing that have to hold exactly, run them with make test
+// Every check that fails prints what went wrong, and the program then exits with an error
+
+
+Color Canvas::drawcolor(1,1,1);
+
+int failures = 0;
+
+void check(bool ok, const char * format, ...){
+    // Counts a failed check and prints it
+    if(ok) return;
+    failures++;
+    va_list args;
+    va_start(args,format);
+    fprintf(stderr,"FAIL ");
+    vfprintf(stderr,format,args);
+    fprintf(stderr,"\n");
+    va_end(args);
+}
+
+bool lit(Canvas * canvas, int x, int y){
+    // If anything was drawn on a pixel of a canvas cleared to black
+    Color c = canvas->getPixelColor(x,y);
+    return c.r || c.g || c.b;
+}
+
+void test_line_steps(){
+    // Every step reached directly with at() is the point the walk gets to, for short lines in all octants
+
+    for(int x1 = -4; x1 <= 4; x1++)
+        for(int y1 = -4; y1 <= 4; y1++)
+            for(int x2 = -4; x2 <= 4; x2++)
+                for(int y2 = -4; y2 <= 4; y2++){
+                    Line line(x1,y1,x2,y2);
+                    long long i = 0;
+                    for(LinePoint p : line){
+                        LinePoint q = line.at(i);
+                        check(p.x == q.x && p.y == q.y,"Line (%d,%d)-(%d,%d) step %lld: walk (%lld,%lld), at (%lld,%lld)",
+                            x1,y1,x2,y2,i,p.x,p.y,q.x,q.y);
+                        i++;
+                    }
+                    check(i == line.getCount(),"Line (%d,%d)-(%d,%d) walks %lld points of %lld",x1,y1,x2,y2,i,line.getCount());
+
+                    // The walk stays in the box of the ends and stops on the second one
+                    for(LinePoint p : line)
+                        check(p.x >= std::min(x1,x2) && p.x <= std::max(x1,x2) && p.y >= std::min(y1,y2) && p.y <= std::max(y1,y2),
+                            "Line (%d,%d)-(%d,%d) leaves its box at (%lld,%lld)",x1,y1,x2,y2,p.x,p.y);
+                    LinePoint end = line.at(line.getCount()-1);
+                    check(end.x == x2 && end.y == y2,"Line (%d,%d)-(%d,%d) ends at (%lld,%lld)",x1,y1,x2,y2,end.x,end.y);
+                }
+
+    // A line that starts off the canvas is clipped onto the same points it would walk
+    Canvas * canvas = new Canvas(40,40);
+    canvas->draw_clear(Color(0,0,0));
+    canvas->draw_line(-1,-1,0,0,false,Color(1,1,1));
+    check(lit(canvas,0,0) && !lit(canvas,0,1) && !lit(canvas,1,0),"draw_line (-1,-1)-(0,0) clipped to the canvas misses (0,0)");
+    delete canvas;
+
+}
+
+int compare_threads(int aa, const std::function<void(Canvas *)> & draw){
+    // Draws the same thing on one thread and on four, returns how many pixels differ
+
+    Canvas * single = new Canvas(40,40), * threaded = new Canvas(40,40);
+    threaded->setThreads(4);
+    int differ = 0;
+    for(Canvas * canvas : {single,threaded}){
+        canvas->setAA(aa);
+        canvas->draw_clear(Color(0,0,0));
+        draw(canvas);
+    }
+    for(int y = 0; y < 40; y++)
+        for(int x = 0; x < 40; x++)
+            if(single->getPixelColor(x,y) != threaded->getPixelColor(x,y)) differ++;
+    delete single;
+    delete threaded;
+    return differ;
+
+}
+
+void test_threads(){
+    // Rasterizing in tiles on many threads gives exactly what one thread draws
+
+    for(int aa : {AA_NONE,AA_2X2,AA_ROTATED}){
+        // Every line of one step around the tile edges (tiles are 16 pixels)
+        for(int x = 13; x <= 18; x++)
+            for(int y = 13; y <= 18; y++)
+                for(int dx = -1; dx <= 1; dx++)
+                    for(int dy = -1; dy <= 1; dy++)
+                        for(bool use_aa : {false,true}){
+                            int differ = compare_threads(aa,[&](Canvas * canvas){
+                                canvas->draw_line(x,y,x+dx,y+dy,use_aa,Color(1,1,1));
+                            });
+                            check(differ == 0,"aa %d line (%d,%d)-(%d,%d)%s: %d pixels differ on 4 threads",
+                                aa,x,y,x+dx,y+dy,use_aa?" with aa":"",differ);
+                        }
+
+        // Random lines and triangles all over the canvas
+        int differ = compare_threads(aa,[&](Canvas * canvas){
+            srand(7);
+            for(int i = 0; i < 200; i++){
+                int v[6];
+                for(int k = 0; k < 6; k++)
+                    v[k] = rand()%50-5;
+                if(i%2) canvas->draw_line(v[0],v[1],v[2],v[3],i%4 == 1,Color(1,1,1));
+                else canvas->fill_triangle(v[0],v[1],(i%7)*0.1,v[2],v[3],(i%5)*0.1,v[4],v[5],(i%3)*0.1,Color(0.5,0.5,0.5));
+            }
+        });
+        check(differ == 0,"aa %d random lines and triangles: %d pixels differ on 4 threads",aa,differ);
+    }
+
+}
+
+int count_lit(Canvas * canvas, int width, int height){
+    int n = 0;
+    for(int y = 0; y < height; y++)
+        for(int x = 0; x < width; x++)
+            if(lit(canvas,x,y)) n++;
+    return n;
+}
+
+void test_behind_camera(){
+    // A triangle behind a perspective camera is not drawn, one in front of it is
+    // The one behind is the one in front mirrored through the camera, where it would show up upside down
+
+    Point position(80,0,30), direction(-1,0,-0.9);
+    Canvas * canvas = new Canvas(100,60);
+    for(double side : {1.0,-1.0}){
+        Point corners[3];
+        double offsets[3][2] = {{0,0},{8,0},{0,8}};
+        for(int k = 0; k < 3; k++)
+            corners[k] = Point(80-side*40,offsets[k][0],30-side*36+offsets[k][1]);
+        for(bool fill : {true,false}){
+            Triangle tri(corners[0],corners[1],corners[2]);
+            Transform * camera = transform_view_per(&position,&direction,100.0);
+            camera->push(matrix_translate(50,30,0));
+            tri.transform(camera);
+            canvas->draw_clear(Color(0,0,0));
+            if(fill) canvas->fill_triangle(&tri,Color(1,1,1));
+            else canvas->draw_triangle(&tri,Color(1,1,1));
+            int n = count_lit(canvas,100,60);
+            if(side > 0) check(n > 0,"%s triangle in front of the camera is not drawn",fill?"filled":"wireframe");
+            else check(n == 0,"%s triangle behind the camera lights %d pixels",fill?"filled":"wireframe",n);
+            delete camera;
+        }
+    }
+    delete canvas;
+
+}
+
+void test_huge_triangle(){
+    // A triangle with points far off the canvas is clipped, not dropped, on one thread and on four
+
+    for(int aa : {AA_NONE,AA_2X2,AA_ROTATED}){
+        for(double far : {1e6,5e6,1e12}){
+            // Covering the whole canvas
+            Canvas * canvas = new Canvas(40,40);
+            canvas->setAA(aa);
+            canvas->draw_clear(Color(0,0,0));
+            canvas->fill_triangle(-far,-10,1,100,-10,1,100,100,1,Color(1,1,1));
+            int n = count_lit(canvas,40,40);
+            check(n == 1600,"aa %d triangle with a point at x = %g lights %d pixels of 1600",aa,-far,n);
+
+            // Below an edge across the canvas at y = 20, so exactly the 20 rows under it
+            canvas->draw_clear(Color(0,0,0));
+            canvas->fill_triangle(-far,20,1,far,20,1,0,-far,1,Color(1,1,1));
+            n = count_lit(canvas,40,40);
+            check(n == 800 && lit(canvas,0,19) && !lit(canvas,0,20),
+                "aa %d triangle under y = 20 with points at %g lights %d pixels of 800",aa,far,n);
+            delete canvas;
+
+            int differ = compare_threads(aa,[&](Canvas * canvas){
+                canvas->fill_triangle(-far,3,1,far,37,1,5,-far,1,Color(1,1,1));
+            });
+            check(differ == 0,"aa %d triangle with points at %g: %d pixels differ on 4 threads",aa,far,differ);
+        }
+    }
+
+}
+
+void test_rotated_grid(){
+    // The rotated grid has a sample in every quarter of a pixel row and column, so a vertical or horizontal edge
+    // that moves across a pixel covers 4, 3, 2 and then 1 of its samples (the 2x2 grid only gets 2 levels there)
+
+    Canvas * canvas = new Canvas(20,20);
+    canvas->setAA(AA_ROTATED);
+    for(int covered = 4; covered >= 1; covered--){
+        double edge = 10+(4-covered)*0.25+0.0625;
+        int expect = (255*covered+2)/4;
+
+        // A vertical edge through the pixels of column 10, everything right of it is filled
+        canvas->draw_clear(Color(0,0,0));
+        canvas->fill_triangle(edge,-50,1,60,-50,1,edge,60,1,Color(1,1,1));
+        int got = canvas->getPixelColor(10,5).r;
+        check(got == expect,"rotated grid, vertical edge at %g: pixel 10 is %d instead of %d",edge,got,expect);
+
+        // A horizontal edge through row 10, everything above it is filled
+        canvas->draw_clear(Color(0,0,0));
+        canvas->fill_triangle(-50,edge,1,60,edge,1,-50,60,1,Color(1,1,1));
+        got = canvas->getPixelColor(5,10).r;
+        check(got == expect,"rotated grid, horizontal edge at %g: pixel 10 is %d instead of %d",edge,got,expect);
+    }
+    delete canvas;
+
+}
+
+void test_filled_shapes(){
+    // The rectangles, circles and polygons cover exactly the pixels they should
+
+    Canvas * canvas = new Canvas(40,40);
+    Color white(1,1,1);
+
+    // Both corners are included, in any order, and the part off the canvas is cut away
+    canvas->draw_clear(Color(0,0,0));
+    canvas->fill_rect(12,7,3,2,white);
+    int n = count_lit(canvas,40,40);
+    check(n == 60 && lit(canvas,3,2) && lit(canvas,12,7) && !lit(canvas,13,7),"fill_rect (12,7)-(3,2) lights %d pixels of 60",n);
+    canvas->draw_clear(Color(0,0,0));
+    canvas->fill_rect(-1000000000,35,1000000000,2000000000,white);
+    n = count_lit(canvas,40,40);
+    check(n == 200,"fill_rect over the top rows lights %d pixels of 200",n);
+
+    // A filled circle covers its outline, and every row of it is one run
+    for(double r : {0.0,1.0,4.5,13.0}){
+        Canvas * outline = new Canvas(40,40);
+        outline->draw_clear(Color(0,0,0));
+        outline->draw_circle(20,20,r,white);
+        canvas->draw_clear(Color(0,0,0));
+        canvas->fill_circle(20,20,r,white);
+        int missing = 0, gaps = 0;
+        for(int y = 0; y < 40; y++){
+            int runs = 0;
+            for(int x = 0; x < 40; x++){
+                if(lit(outline,x,y) && !lit(canvas,x,y)) missing++;
+                if(lit(canvas,x,y) && (x == 0 || !lit(canvas,x-1,y))) runs++;
+            }
+            if(runs > 1) gaps++;
+        }
+        check(missing == 0 && gaps == 0,"fill_circle of radius %g misses %d pixels of the outline, %d rows have gaps",r,missing,gaps);
+        delete outline;
+    }
+
+    // A huge circle covers everything near its center, and one that far away covers nothing
+    canvas->draw_clear(Color(0,0,0));
+    canvas->fill_circle(20,20,3e9,white);
+    n = count_lit(canvas,40,40);
+    check(n == 1600,"fill_circle of radius 3e9 lights %d pixels of 1600",n);
+    canvas->draw_clear(Color(0,0,0));
+    canvas->fill_circle(20,-3e9,3e9+10,white);
+    n = count_lit(canvas,40,40);
+    check(n >= 400 && n <= 480 && lit(canvas,0,8) && !lit(canvas,20,12),"fill_circle just over the bottom lights %d pixels",n);
+    canvas->draw_clear(Color(0,0,0));
+    canvas->fill_circle(1e15,1e15,1e6,white);
+    check(count_lit(canvas,40,40) == 0,"fill_circle far away lights pixels");
+
+    // A rectangle as a polygon lights the pixels with centers inside it, and its two halves split them exactly
+    double square[] = {2,2,12,2,12,7,2,7}, lower[] = {2,2,12,2,12,7}, upper[] = {2,2,12,7,2,7};
+    int counts[3];
+    const double * shapes[3] = {square,lower,upper};
+    for(int k = 0; k < 3; k++){
+        canvas->draw_clear(Color(0,0,0));
+        canvas->fill_polygon(shapes[k],(k == 0)?4:3,white);
+        counts[k] = count_lit(canvas,40,40);
+    }
+    check(counts[0] == 50 && counts[1]+counts[2] == 50,"fill_polygon square lights %d pixels of 50, its halves %d and %d",
+        counts[0],counts[1],counts[2]);
+    canvas->draw_clear(Color(0,0,0));
+    canvas->fill_polygon(lower,3,white);
+    canvas->fill_polygon(upper,3,white);
+    n = count_lit(canvas,40,40);
+    check(n == 50,"fill_polygon halves of a square together light %d pixels of 50",n);
+
+    // Even-odd: the middle of a polygon that goes around twice is left out
+    double twice[] = {0,0,30,0,30,30,0,30,0,0,20,10,20,20,10,20,10,10,20,10};
+    canvas->draw_clear(Color(0,0,0));
+    canvas->fill_polygon(twice,10,white);
+    check(lit(canvas,5,5) && !lit(canvas,15,15),"fill_polygon does not leave out the inner square");
+    delete canvas;
+
+}
+
+Mesh * mesh_quad(const double * corners){
+    // Two triangles between four corners (x,y pairs at z = 0.5), counter-clockwise as given
+    Mesh * mesh = new Mesh(4,2);
+    for(int i = 0; i < 4; i++)
+        mesh->setVertex(i,corners[2*i],corners[2*i+1],0.5);
+    mesh->setTriangle(0,0,1,2);
+    mesh->setTriangle(1,0,2,3);
+    mesh->build_edges();
+    return mesh;
+}
+
+void test_culled_wireframe(){
+    // Back-face culling leaves a wireframe facing the camera as it is, removes one facing away, and counts both
+
+    double front[] = {5,5,30,5,30,30,5,30}, back[] = {5,5,5,30,30,30,30,5};
+    Transform * identity = new Transform();
+    Canvas * plain = new Canvas(40,40), * culled = new Canvas(40,40);
+    plain->setCulling(CULL_NONE);
+    culled->setCulling(CULL_FRUSTUM|CULL_BACKFACE);
+    for(bool facing : {true,false}){
+        Mesh * quad = mesh_quad(facing?front:back);
+        for(Canvas * canvas : {plain,culled}){
+            canvas->draw_clear(Color(0,0,0));
+            canvas->resetCullStats();
+            canvas->draw_mesh(quad,identity,Color(1,1,1));
+        }
+        int differ = 0;
+        for(int y = 0; y < 40; y++)
+            for(int x = 0; x < 40; x++)
+                if(lit(plain,x,y) != lit(culled,x,y)) differ++;
+        CullStats stats = culled->getCullStats();
+        int drawn = count_lit(culled,40,40);
+        if(facing) check(differ == 0 && drawn > 0,"Culling changes %d pixels of a wireframe facing the camera",differ);
+        else check(drawn == 0,"A wireframe facing away lights %d pixels with culling",drawn);
+        check(stats.meshes == 1 && stats.meshes_culled == 0 && stats.triangles == 2 &&
+            stats.triangles_culled == (facing?0:2) && stats.edges == 5 && stats.edges_culled == (facing?0:5),
+            "Culling a quad facing %s counts %ld/%ld meshes, %ld/%ld triangles and %ld/%ld edges",facing?"the camera":"away",
+            stats.meshes_culled,stats.meshes,stats.triangles_culled,stats.triangles,stats.edges_culled,stats.edges);
+
+        // Filled, the same triangles are tested
+        culled->resetCullStats();
+        culled->fill_mesh(quad,identity,Color(1,1,1));
+        stats = culled->getCullStats();
+        check(stats.triangles == 2 && stats.triangles_culled == (facing?0:2) && stats.edges == 0,
+            "Filling a quad facing %s counts %ld/%ld triangles",facing?"the camera":"away",stats.triangles_culled,stats.triangles);
+        delete quad;
+    }
+
+    // A corner very far away is drawn towards, not wrapped around
+    double far[] = {5,5,1e20,5,1e20,1e20,5,1e20};
+    Mesh * quad = mesh_quad(far);
+    culled->draw_clear(Color(0,0,0));
+    culled->draw_mesh(quad,identity,Color(1,1,1));
+    check(lit(culled,39,5) && !lit(culled,4,5) && lit(culled,5,39),"A wireframe with a corner at 1e20 is not drawn towards it");
+    delete quad;
+
+    delete plain;
+    delete culled;
+    delete identity;
+
+}
+
+void test_front_sign(){
+    // The side that faces the camera comes from the matrices, not from the shape of their last row
+
+    // Mirroring x keeps the outside of a quad towards the camera, but makes it clockwise on the screen
+    double front[] = {5,5,30,5,30,30,5,30}, back[] = {5,5,5,30,30,30,30,5};
+    Transform * mirror = new Transform();
+    mirror->push(matrix_scale(-1,1,1));
+    mirror->push(matrix_translate(40,0,0));
+    Canvas * canvas = new Canvas(40,40);
+    canvas->setCulling(CULL_FRUSTUM|CULL_BACKFACE);
+    for(bool facing : {true,false}){
+        Mesh * quad = mesh_quad(facing?front:back);
+        canvas->draw_clear(Color(0,0,0));
+        canvas->resetCullStats();
+        canvas->fill_mesh(quad,mirror,Color(1,1,1));
+        CullStats stats = canvas->getCullStats();
+        int drawn = count_lit(canvas,40,40);
+        check(facing?drawn > 0:drawn == 0,"A mirrored quad facing %s lights %d pixels",facing?"the camera":"away",drawn);
+        check(stats.triangles_culled == (facing?0:2),"A mirrored quad facing %s culls %ld triangles",
+            facing?"the camera":"away",stats.triangles_culled);
+        delete quad;
+    }
+    delete mirror;
+
+    // A projection that puts the distance in w (looking at -z, as OpenGL does) with the front set to 1
+    // The quad is moved to z = -0.5 and lands on the pixels 10 to 30
+    double small_front[] = {-0.5,-0.5,0.5,-0.5,0.5,0.5,-0.5,0.5}, small_back[] = {-0.5,-0.5,-0.5,0.5,0.5,0.5,0.5,-0.5};
+    Mat4 gl = matrix_scale(10,10,0);
+    gl.set(0,2,-20);
+    gl.set(1,2,-20);
+    gl.set(2,3,1);
+    gl.set(3,2,-1);
+    gl.set(3,3,0);
+    Transform * projected = new Transform();
+    projected->push(matrix_translate(0,0,-1));
+    projected->push(gl);
+    canvas->setProjectionFront(1);
+    for(bool facing : {true,false}){
+        Mesh * quad = mesh_quad(facing?small_front:small_back);
+        canvas->draw_clear(Color(0,0,0));
+        canvas->resetCullStats();
+        canvas->fill_mesh(quad,projected,Color(1,1,1));
+        CullStats stats = canvas->getCullStats();
+        check(facing?(lit(canvas,20,20) && !lit(canvas,5,20)):count_lit(canvas,40,40) == 0,
+            "A quad facing %s through a projection with w = -z is drawn wrong",facing?"the camera":"away");
+        check(stats.meshes_culled == 0 && stats.triangles_culled == (facing?0:2),
+            "A quad facing %s through a projection with w = -z culls %ld meshes and %ld triangles",
+            facing?"the camera":"away",stats.meshes_culled,stats.triangles_culled);
+        delete quad;
+    }
+
+    // Without culling both sides are drawn
+    canvas->setCulling(CULL_FRUSTUM);
+    Mesh * quad = mesh_quad(small_back);
+    canvas->draw_clear(Color(0,0,0));
+    canvas->fill_mesh(quad,projected,Color(1,1,1));
+    check(lit(canvas,20,20),"A quad facing away through a projection with w = -z is not drawn without culling");
+    delete quad;
+    delete projected;
+    delete canvas;
+
+}
+
+void test_letters(){
+    // Without dithering every pixel gets the letter Color::getLetter gives its color, for every sum of the channels
+
+    Canvas * canvas = new Canvas(32,24);
+    canvas->draw_clear(Color(0,0,0));
+    for(int sum = 0; sum <= 765; sum++){
+        int r = std::min(sum,255), g = std::min(sum-r,255), b = sum-r-g;
+        canvas->draw_pixel(sum%32,sum/32,color_bytes(r,g,b));
+    }
+    canvas->render_offscreen();
+    char letters[32*24];
+    canvas->copy_letters(letters);
+    for(int sum = 0; sum <= 765; sum++){
+        Color c = canvas->getPixelColor(sum%32,sum/32);
+        char letter = letters[(23-sum/32)*32+sum%32];
+        check(letter == c.getLetter(),"Channels summing to %d are shaded '%c' instead of '%c'",sum,letter,c.getLetter());
+    }
+    delete canvas;
+
+}
+
+bool same_matrix(const Mat4 & a, const Mat4 & b){
+    for(int i = 0; i < 4; i++)
+        for(int j = 0; j < 4; j++)
+            if(a.m[i][j] != b.m[i][j]) return false;
+    return true;
+}
+
+void test_transform_slots(){
+    // Setting a slot past the end of a transformation grows it, with identities in between
+    // A copy would share the arrays of matrices and delete them twice, so there are none
+
+    static_assert(!std::is_copy_constructible<Transform>::value && !std::is_copy_assignable<Transform>::value,
+        "A Transform must not be copied");
+    Point position(80,0,30), direction(-1,0,-0.9);
+    Transform * made = transform_view_per(&position,&direction,100.0);
+    Transform * bare = new Transform();
+    view_per(bare,&position,&direction,100.0);
+    check(bare->getSlotNo() == 6,"view_per on a new transformation gives %d slots instead of 6",bare->getSlotNo());
+    check(same_matrix(bare->getMatrix(),made->getMatrix()),"view_per on a new transformation differs from transform_view_per");
+
+    // Well past the space the stack starts with
+    Transform * far = new Transform();
+    far->set(20,matrix_translate(1,2,3));
+    check(far->getSlotNo() == 21,"set(20) gives %d slots instead of 21",far->getSlotNo());
+    check(same_matrix(far->getMatrix(),matrix_translate(1,2,3)),"set(20) does not give the matrix of slot 20");
+    delete made;
+    delete bare;
+    delete far;
+
+}
+
+std::vector<char> read_file(const char * path){
+    std::vector<char> bytes;
+    FILE * file = fopen(path,"rb");
+    if(!file) return bytes;
+    char buffer[4096];
+    size_t n;
+    while((n = fread(buffer,1,sizeof(buffer),file)) > 0)
+        bytes.insert(bytes.end(),buffer,buffer+n);
+    fclose(file);
+    return bytes;
+}
+
+void write_file(const char * path, const void * data, size_t size){
+    FILE * file = fopen(path,"wb");
+    fwrite(data,1,size,file);
+    fclose(file);
+}
+
+bool same_mesh(Mesh * a, Mesh * b){
+    // If two meshes have the same vertices, triangles and edges
+    int n = a->getVertexNo(), t = a->getTriangleNo(), e = a->getEdgeNo();
+    if(n != b->getVertexNo() || t != b->getTriangleNo() || e != b->getEdgeNo()) return false;
+    return memcmp(a->getX(),b->getX(),4*n) == 0 && memcmp(a->getY(),b->getY(),4*n) == 0 &&
+        memcmp(a->getZ(),b->getZ(),4*n) == 0 && memcmp(a->getTriangles(),b->getTriangles(),12*t) == 0 &&
+        (e == 0 || (memcmp(a->getEdges(),b->getEdges(),8*e) == 0 && memcmp(a->getEdgeFaces(),b->getEdgeFaces(),8*e) == 0)) &&
+        memcmp(a->getBounds(),b->getBounds(),6*sizeof(float)) == 0;
+}
+
+void test_mesh_file(){
+    // A mesh saved to a mesh file loads back the same, and a file with an index outside the mesh is refused
+
+    const char * path = "test_mesh.amesh", * broken = "test_broken.amesh";
+    Point c1(-1,2,3), c2(4,5,7);
+    Mesh * cube = mesh_cube(&c1,&c2);
+    check(save_mesh_file(cube,path),"save_mesh_file fails");
+    Mesh * loaded = load_mesh_file(path);
+    check(loaded && loaded->isBorrowed() && same_mesh(cube,loaded),"A saved cube does not load back the same");
+    delete loaded;
+
+    // Without its edges, they are found again on loading
+    Mesh * bare = new Mesh(8,12);
+    for(int i = 0; i < 8; i++)
+        bare->setVertex(i,cube->getX()[i],cube->getY()[i],cube->getZ()[i]);
+    for(int i = 0; i < 12; i++)
+        bare->setTriangle(i,cube->getTriangles()[3*i],cube->getTriangles()[3*i+1],cube->getTriangles()[3*i+2]);
+    check(save_mesh_file(bare,path),"save_mesh_file fails without edges");
+    loaded = load_mesh_file(path);
+    check(loaded && same_mesh(cube,loaded),"A cube saved without edges does not load back with them");
+    delete loaded;
+    delete bare;
+
+    // Change one number of the file at a time
+    check(save_mesh_file(cube,path),"save_mesh_file fails");
+    std::vector<char> bytes = read_file(path);
+    MeshFileHeader header;
+    memcpy(&header,bytes.data(),sizeof(header));
+    struct{
+        const char * what;
+        uint64_t offset;
+        int value;
+    } breaks[] = {
+        {"a triangle index past the vertices",header.triangles+4*5,8},
+        {"a negative triangle index",header.triangles,-1},
+        {"an edge index past the vertices",header.edges+4*3,8},
+        {"an edge face past the triangles",header.edge_faces+4,12},
+        {"an edge without a first face",header.edge_faces,-1}
+    };
+    for(auto & b : breaks){
+        std::vector<char> copy = bytes;
+        memcpy(copy.data()+b.offset,&b.value,4);
+        write_file(broken,copy.data(),copy.size());
+        Mesh * mesh = load_mesh_file(broken);
+        check(mesh == nullptr,"A mesh file with %s loads",b.what);
+        delete mesh;
+    }
+    write_file(broken,bytes.data(),bytes.size()-4);
+    Mesh * cut = load_mesh_file(broken);
+    check(cut == nullptr,"A cut off mesh file loads");
+    delete cut;
+
+    delete cube;
+    remove(path);
+    remove(broken);
+
+}
+
+bool has_triangles(Mesh * mesh, const int * expect, int n){
+    return mesh->getTriangleNo() == n && memcmp(mesh->getTriangles(),expect,12*n) == 0;
+}
+
+void test_loaders(){
+    // The OBJ and STL parsers on the small files in fixtures/, run from the top of the repository
+
+    // Every form of face: plain, v/vt, v//vn, v/vt/vn, a polygon split in a fan and negative indices
+    for(int threads : {1,4}){
+        Mesh * mesh = load_obj("fixtures/faces.obj",true,threads);
+        static const int faces[] = {0,1,2, 0,2,3, 0,1,2, 0,1,2, 0,2,4, 0,4,3, 5,4,3};
+        check(mesh && mesh->getVertexNo() == 6 && has_triangles(mesh,faces,7),
+            "fixtures/faces.obj on %d threads does not give its 6 vertices and 7 triangles",threads);
+        if(mesh){
+            check(mesh->getX()[4] == 0.5f && mesh->getY()[4] == 1.5f && mesh->getZ()[5] == 2.0f,
+                "fixtures/faces.obj has the wrong positions");
+            check(mesh->getEdgeNo() == 10,"fixtures/faces.obj has %d edges instead of 10",mesh->getEdgeNo());
+        }
+        delete mesh;
+    }
+
+    // Broken files give nothing
+    for(const char * path : {"fixtures/bad_index.obj","fixtures/bad_zero.obj","fixtures/bad_number.obj",
+        "fixtures/bad_count.stl","fixtures/short_binary.stl","fixtures/missing.obj"}){
+        Mesh * mesh = load_mesh(path);
+        check(mesh == nullptr,"%s loads",path);
+        delete mesh;
+    }
+
+    // The same square as ASCII and as binary (with a header that starts with "solid"), the corners
+    // the two triangles share are welded (-0 and 0 too) so there are 4 vertices
+    for(const char * path : {"fixtures/square.stl","fixtures/square_binary.stl"}){
+        Mesh * mesh = load_mesh(path);
+        static const int faces[] = {0,1,2, 0,2,3};
+        check(mesh && mesh->getVertexNo() == 4 && has_triangles(mesh,faces,2),
+            "%s does not give a square of 4 vertices and 2 triangles",path);
+        if(mesh) check(mesh->getX()[3] == 0 && mesh->getY()[3] == 1,"%s has the wrong positions",path);
+        delete mesh;
+    }
+
+}
+
+std::vector<char> drain(int fd){
+    // Reads everything waiting in a non-blocking pipe
+    std::vector<char> out;
+    char buffer[4096];
+    int n;
+    while((n = read(fd,buffer,sizeof(buffer))) > 0)
+        out.insert(out.end(),buffer,buffer+n);
+    return out;
+}
+
+void draw_frame(Canvas * canvas, int lit_no){
+    // A black canvas with its first lit_no pixels white
+    canvas->draw_clear(Color(0,0,0));
+    for(int i = 0; i < lit_no; i++)
+        canvas->draw_pixel(i%canvas->getWidth(),i/canvas->getWidth(),Color(1,1,1));
+}
+
+void test_emitter_pipe(){
+    // The frames a canvas renders reach a pipe whole, even when the pipe can't take them at once
+
+    // A pipe in packet mode keeps every write apart, so a single read shows a frame left in one write
+    int fds[2];
+    check(pipe2(fds,O_DIRECT|O_NONBLOCK) == 0,"A packet pipe can't be made");
+    Canvas * canvas = new Canvas(20,10);
+    canvas->getEmitter()->setOutput(fds[1]);
+    draw_frame(canvas,30);
+    canvas->render();
+    char packet[8192];
+    int first = read(fds[0],packet,sizeof(packet));
+    long bytes = canvas->getFrameBytes();
+    check(bytes > 0 && first == bytes,"A frame of %ld bytes leaves in a write of %d",bytes,first);
+    check(read(fds[0],packet,sizeof(packet)) < 0 && errno == EAGAIN,"A frame leaves in more than one write");
+    close(fds[0]);
+    close(fds[1]);
+
+    // A frame bigger than a non-blocking pipe is written part by part, waiting for the pipe while it's full
+    check(pipe2(fds,O_NONBLOCK) == 0,"A pipe can't be made");
+    int capacity = fcntl(fds[1],F_SETPIPE_SZ,4096);
+    FrameEmitter * emitter = new FrameEmitter(16,fds[1]);
+    std::vector<char> expected;
+    for(int i = 0; i < 20*capacity; i++){
+        char c = 'a'+i%26;
+        emitter->put(c);
+        expected.push_back(c);
+    }
+    std::vector<char> received;
+    std::atomic<bool> flushed(false);
+    std::thread reader([&](){
+        while((int)received.size() < 20*capacity){
+            usleep(200);
+            bool last = flushed;
+            std::vector<char> part = drain(fds[0]);
+            received.insert(received.end(),part.begin(),part.end());
+            if(last && part.empty()) break;
+        }
+    });
+    bool sent = emitter->flush();
+    flushed = true;
+    reader.join();
+    check(sent && received == expected,"A frame of %d bytes through a pipe of %d arrives as %d bytes",
+        20*capacity,capacity,(int)received.size());
+    delete emitter;
+    close(fds[0]);
+    close(fds[1]);
+
+    // After a frame that could not be written the next one is the whole view, as for a new canvas
+    check(pipe2(fds,O_NONBLOCK) == 0,"A pipe can't be made");
+    signal(SIGPIPE,SIG_IGN);
+    int broken[2];
+    check(pipe(broken) == 0,"A pipe can't be made");
+    close(broken[0]);
+    canvas->getEmitter()->setOutput(broken[1]);
+    draw_frame(canvas,60);
+    canvas->render();
+    canvas->getEmitter()->setOutput(fds[1]);
+    canvas->render();
+    std::vector<char> again = drain(fds[0]);
+    Canvas * fresh = new Canvas(20,10);
+    fresh->getEmitter()->setOutput(fds[1]);
+    draw_frame(fresh,60);
+    fresh->render();
+    std::vector<char> whole = drain(fds[0]);
+    check(!again.empty() && again == whole,"The frame after a failed one sends %d bytes instead of the %d of the whole view",
+        (int)again.size(),(int)whole.size());
+    signal(SIGPIPE,SIG_DFL);
+    close(broken[1]);
+    close(fds[0]);
+    close(fds[1]);
+    delete fresh;
+    delete canvas;
+
+}
+
+void test_batch_kernels(){
+    // Every kernel transform_points can use gives the same floats as the scalar one
+    // The ranges start off the lane width and leave a tail shorter than it, so the leftovers are tested too
+
+    const int n = 53;
+    float x[n], y[n], z[n];
+    srand(11);
+    for(int i = 0; i < n; i++){
+        x[i] = rand()%2000*0.01f-10;
+        y[i] = rand()%2000*0.01f-10;
+        z[i] = rand()%2000*0.01f-30;
+    }
+    Point position(3,-2,10), direction(-0.2,0.1,-1);
+    Transform * camera = transform_view_per(&position,&direction,40);
+    float m[16];
+    for(int r = 0; r < 4; r++)
+        for(int c = 0; c < 4; c++)
+            m[4*r+c] = (float)camera->getMatrix().m[r][c];
+
+    float expected[3][n];
+    batch_scalar(m,x,y,z,expected[0],expected[1],expected[2],0,n);
+    for(int kernel : {BATCH_SSE,BATCH_AVX2}){
+        int picked = batch_select(kernel);
+        if(picked != kernel){
+            printf("Kernel %d is not supported here, %d was tested instead\n",kernel,picked);
+            continue;
+        }
+        for(int from : {0,3})
+            for(int to : {n,n-1,from+7,from+1}){
+                float out[3][n];
+                for(int k = 0; k < 3; k++)
+                    for(int i = 0; i < n; i++)
+                        out[k][i] = -1;
+                batch_selected(m,x,y,z,out[0],out[1],out[2],from,to);
+                int differ = 0, outside = 0;
+                for(int k = 0; k < 3; k++)
+                    for(int i = 0; i < n; i++){
+                        if(i < from || i >= to) outside += out[k][i] != -1;
+                        else differ += memcmp(&out[k][i],&expected[k][i],sizeof(float)) != 0;
+                    }
+                check(differ == 0 && outside == 0,"Kernel %d on points %d to %d: %d values differ, %d written outside",
+                    kernel,from,to,differ,outside);
+            }
+
+        // transform_points goes through the picked kernel, in place as well
+        float px[n], py[n], pz[n];
+        memcpy(px,x,sizeof(x));
+        memcpy(py,y,sizeof(y));
+        memcpy(pz,z,sizeof(z));
+        transform_points(camera,px,py,pz,px,py,pz,n);
+        check(memcmp(px,expected[0],sizeof(px)) == 0 && memcmp(py,expected[1],sizeof(py)) == 0 &&
+            memcmp(pz,expected[2],sizeof(pz)) == 0,"transform_points in place with kernel %d differs from the scalar one",kernel);
+    }
+    batch_select();
+    delete camera;
+
+}
+
+void test_depth(){
+    // The closer of two overlapping triangles is the one that shows, whichever is drawn first
+
+    Canvas * canvas = new Canvas(40,40);
+    for(bool near_first : {true,false}){
+        canvas->draw_clear(Color(0,0,0));
+        for(int k = 0; k < 2; k++){
+            if((k == 0) == near_first) canvas->fill_triangle(10,5,0.5,35,5,0.5,10,30,0.5,Color(0,1,0));
+            else canvas->fill_triangle(2,2,0.2,30,2,0.2,2,30,0.2,Color(1,0,0));
+        }
+        Color both = canvas->getPixelColor(12,8), far = canvas->getPixelColor(4,20), near = canvas->getPixelColor(30,6);
+        check(both.g == 255 && both.r == 0 && far.r == 255 && near.g == 255,
+            "Drawing the %s triangle first hides the closer one where they overlap",near_first?"closer":"farther");
+    }
+
+    // Triangles that go through each other: the depth grows to the right on the red one, so the green one shows on the left
+    canvas->draw_clear(Color(0,0,0));
+    canvas->fill_triangle(0,0,0.2,40,0,0.8,0,40,0.2,Color(1,0,0));
+    canvas->fill_triangle(0,0,0.5,40,0,0.5,0,40,0.5,Color(0,1,0));
+    Color left = canvas->getPixelColor(5,5), right = canvas->getPixelColor(30,5);
+    check(left.g == 255 && left.r == 0 && right.r == 255 && right.g == 0,"Triangles that cross in depth don't cross at their middle");
+    delete canvas;
+
+    // A fan from the middle of a rectangle covers every subpixel in it once, also where the edges cross the centers
+    // Every triangle is drawn on its own and the amounts of white they leave are added up
+    double fan[8][2] = {{4,6},{20.5,6},{36,6},{36,18.5},{36,30},{20.5,30},{4,30},{4,18.5}};
+    for(int aa : {AA_NONE,AA_2X2,AA_ROTATED}){
+        std::vector<int> sum(40*40,0);
+        canvas = new Canvas(40,40);
+        canvas->setAA(aa);
+        for(int i = 0; i < 8; i++){
+            canvas->draw_clear(Color(0,0,0));
+            canvas->fill_triangle(20.5,18.5,0.5,fan[i][0],fan[i][1],0.5,fan[(i+1)%8][0],fan[(i+1)%8][1],0.5,Color(1,1,1));
+            for(int y = 0; y < 40; y++)
+                for(int x = 0; x < 40; x++)
+                    sum[y*40+x] += canvas->getPixelColor(x,y).r;
+        }
+        int wrong = 0;
+        for(int y = 0; y < 40; y++)
+            for(int x = 0; x < 40; x++){
+                bool inside = x >= 4 && x < 36 && y >= 6 && y < 30;
+                // With aa every part of a pixel is rounded on its own, so the parts can add up to a little off
+                int slack = (aa == AA_NONE)?0:2;
+                if(inside?std::abs(sum[y*40+x]-255) > slack:sum[y*40+x] != 0) wrong++;
+            }
+        check(wrong == 0,"aa %d fan over a rectangle: %d pixels are not covered exactly once",aa,wrong);
+        delete canvas;
+    }
+
+}
+
+void test_emitter_diff(){
+    // A frame sends only the pixels whose letters changed since the last one, and nothing if none did
+
+    int fds[2];
+    check(pipe2(fds,O_NONBLOCK) == 0,"A pipe can't be made");
+    Canvas * canvas = new Canvas(20,10);
+    canvas->getEmitter()->setOutput(fds[1]);
+    draw_frame(canvas,0);
+    canvas->render();
+    drain(fds[0]);
+
+    canvas->render();
+    std::vector<char> same = drain(fds[0]);
+    check(same.empty() && canvas->getFrameBytes() == 0,"A frame with no changes sends %d bytes",(int)same.size());
+
+    // Two pixels next to each other on row 3 and one on row 7, each run of pixels needs a single move
+    canvas->draw_pixel(5,3,Color(1,1,1));
+    canvas->draw_pixel(6,3,Color(1,1,1));
+    canvas->draw_pixel(12,7,Color(1,1,1));
+    canvas->render();
+    std::vector<char> changed = drain(fds[0]);
+    char letters[200];
+    canvas->copy_letters(letters);
+    char w = letters[(9-3)*20+5], expected[64];
+    int n = sprintf(expected,"\033[4;27H%c%c\033[8;13H%c%c%c%c\033[13;1H",w,w,w,w,w,w);
+    check(w != ' ' && changed == std::vector<char>(expected,expected+n),"Three changed pixels send %d bytes that are not the %d of their cells",
+        (int)changed.size(),n);
+
+    // Clearing them again sends the same cells back
+    draw_frame(canvas,0);
+    canvas->render();
+    changed = drain(fds[0]);
+    n = sprintf(expected,"\033[4;27H  \033[8;13H    \033[13;1H");
+    check(changed == std::vector<char>(expected,expected+n),"Clearing three pixels sends %d bytes that are not the %d of their cells",
+        (int)changed.size(),n);
+
+    close(fds[0]);
+    close(fds[1]);
+    delete canvas;
+
+}
+
+int ramp_level(GlyphRamp * glyphs, char c){
+    // The level of a letter of a ramp
+    return strchr(glyphs->getRamp(),c)-glyphs->getRamp();
+}
+
+void test_dithering(){
+    // Dithering picks letters around the brightness that average out to it
+
+    GlyphRamp * glyphs = new GlyphRamp(RAMP_10);
+    int levels = glyphs->getLevels();
+    const int width = 19; // Two blocks of 8 for the SSE path and a tail
+    unsigned char in[16*width];
+    char out[16*width];
+
+    // Ordered: every cell is the brightness in levels (out of 65536) plus the Bayer threshold of its place,
+    // rounded down, and every 4x4 block has the brightness on average (the 16 thresholds cut a level in 16 steps)
+    static const int bayer[4][4] = {{0,8,2,10},{12,4,14,6},{3,11,1,9},{15,7,13,5}};
+    int scale = ((levels-1)*65536+254)/255, wrong = 0, off = 0;
+    for(int v = 0; v < 256; v++){
+        std::fill(in,in+4*width,(unsigned char)v);
+        glyphs->shade(in,out,width,0,4,DITHER_ORDERED);
+        double exact = v*(levels-1)/255.0, sum = 0;
+        for(int y = 0; y < 4; y++)
+            for(int x = 0; x < width; x++){
+                int level = ramp_level(glyphs,out[y*width+x]);
+                if(level != (v*scale+bayer[y][x%4]*4096+2048)>>16) wrong++;
+                if(x < 4) sum += level;
+            }
+        // The scale is rounded up, which moves the levels by less than 255/65536
+        if(std::abs(sum/16-exact) > 1/32.0+255/65536.0) off++;
+    }
+    check(wrong == 0,"Ordered dithering puts %d cells on the wrong level",wrong);
+    check(off == 0,"Ordered dithering gets the average of %d brightnesses wrong",off);
+
+    // Without dithering every cell is the letter of its brightness
+    for(int v = 0; v < 256; v++)
+        in[v%(16*width)] = v;
+    glyphs->shade(in,out,width,0,16,DITHER_NONE);
+    wrong = 0;
+    for(int i = 0; i < 16*width; i++)
+        if(out[i] != glyphs->getLetter(in[i])) wrong++;
+    check(wrong == 0,"Shading without dithering changes %d letters",wrong);
+
+    // Floyd-Steinberg: a flat area averages to its brightness, and the levels of the ramp stay flat
+    off = 0;
+    for(int v = 0; v < 256; v += 5){
+        std::fill(in,in+16*width,(unsigned char)v);
+        glyphs->shade(in,out,width,0,16,DITHER_FLOYD);
+        double exact = v*(levels-1)/255.0, sum = 0;
+        int spread = 0;
+        for(int i = 0; i < 16*width; i++){
+            int level = ramp_level(glyphs,out[i]);
+            sum += level;
+            if(std::abs(level-exact) >= 1) spread++;
+        }
+        if(std::abs(sum/(16*width)-exact) > 0.05 || spread) off++;
+    }
+    check(off == 0,"Floyd-Steinberg gets %d flat areas wrong",off);
+
+    // The errors it keeps between frames start over every frame, whatever the width was before
+    for(int i = 0; i < 16*width; i++)
+        in[i] = (i*37)%256;
+    GlyphRamp * fresh = new GlyphRamp(RAMP_10);
+    char expected[16*width];
+    fresh->shade(in,expected,7,0,16,DITHER_FLOYD);
+    for(int w : {width,7,3,7}){
+        glyphs->shade(in,out,w,0,16,DITHER_FLOYD);
+        if(w == 7) check(memcmp(out,expected,7*16) == 0,"Floyd-Steinberg depends on the frames shaded before");
+    }
+    delete fresh;
+    delete glyphs;
+
+}
+
+struct CastEvent{
+    double time;
+    std::string type, data;
+};
+
+bool parse_event(const std::string & line, CastEvent & event){
+    // Reads a line [time, "type", "data"] of an asciicast file, the data with its JSON escapes undone
+    char type[8];
+    int start;
+    if(sscanf(line.c_str(),"[%lf, \"%7[a-z]\", %n",&event.time,type,&start) != 2 || line[start] != '"') return false;
+    event.type = type;
+    event.data.clear();
+    size_t i = start+1;
+    for(; i < line.size() && line[i] != '"'; i++){
+        if(line[i] != '\\'){
+            event.data += line[i];
+            continue;
+        }
+        i++;
+        if(i < line.size() && line[i] == 'u' && i+4 < line.size()){
+            event.data += (char)strtol(line.substr(i+1,4).c_str(),nullptr,16);
+            i += 4;
+        }else if(i < line.size()){
+            event.data += line[i];
+        }
+    }
+    return i+2 == line.size() && line[i+1] == ']';
+}
+
+void test_recorder(){
+    // A recording is an asciicast v2 file: a header, then a line for every frame that changed, the keyframes
+    // after a marker, and the frames in between hold exactly the bytes that went to the terminal
+
+    const char * path = "test_record.cast";
+    int fds[2];
+    check(pipe2(fds,O_NONBLOCK) == 0,"A pipe can't be made");
+    Canvas * canvas = new Canvas(20,10);
+    canvas->getEmitter()->setOutput(fds[1]);
+    Recorder * recorder = canvas->record(path,1000);
+    check(recorder != nullptr,"%s can't be recorded to",path);
+    if(!recorder){
+        delete canvas;
+        return;
+    }
+
+    // A keyframe, a change, a frame with nothing new, a change, and a keyframe once they are due every time
+    std::vector<char> sent;
+    for(int frame = 0; frame < 5; frame++){
+        if(frame == 4) recorder->setKeyframeInterval(0);
+        if(frame != 2) draw_frame(canvas,frame*7);
+        canvas->render();
+        std::vector<char> bytes = drain(fds[0]);
+        if(frame == 1) sent = bytes;
+    }
+    check(recorder->getFrames() == 4 && recorder->getKeyframes() == 2,"Recording 5 frames stores %ld with %ld keyframes",
+        recorder->getFrames(),recorder->getKeyframes());
+    recorder->close();
+    canvas->setRecorder(nullptr);
+    delete recorder;
+
+    // The header has the size of the canvas on the terminal
+    std::vector<char> bytes = read_file(path);
+    std::string text(bytes.begin(),bytes.end());
+    std::vector<std::string> lines;
+    for(size_t at = 0, end; (end = text.find('\n',at)) != std::string::npos; at = end+1)
+        lines.push_back(text.substr(at,end-at));
+    int columns = 0, rows = 0;
+    long stamp = 0;
+    check(!lines.empty() && sscanf(lines[0].c_str(),"{\"version\": 2, \"width\": %d, \"height\": %d, \"timestamp\": %ld}",
+        &columns,&rows,&stamp) == 3 && columns == 44 && rows == 13 && stamp > 0,"The recording has the header %s",
+        lines.empty()?"(none)":lines[0].c_str());
+
+    // Then a marker and the first keyframe, the change, the second change, and another marker and keyframe
+    static const char * types[] = {"m","o","o","o","m","o"};
+    std::vector<CastEvent> events;
+    for(size_t i = 1; i < lines.size(); i++){
+        CastEvent event;
+        check(parse_event(lines[i],event),"The recording has the line %s",lines[i].c_str());
+        events.push_back(event);
+    }
+    bool order = events.size() == 6;
+    for(size_t i = 0; order && i < events.size(); i++){
+        order = events[i].type == types[i] && (i == 0 || events[i].time >= events[i-1].time);
+        if(events[i].type == "m") order = order && events[i].data == "keyframe" && events[i+1].time == events[i].time;
+    }
+    check(order,"The recording has %d events that are not marker, keyframe, change, change, marker, keyframe",(int)events.size());
+    if(order){
+        check(events[1].data.compare(0,4,"\033[2J") == 0 && events[5].data.compare(0,4,"\033[2J") == 0,
+            "A keyframe does not clear the screen first");
+        check(events[2].data == std::string(sent.begin(),sent.end()),"A recorded change is not the bytes sent to the terminal");
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+    delete canvas;
+    remove(path);
+
+}
+
+template <int C, typename T>
+Matrix<4,C,T> plain_product(const Matrix<4,4,T> & a, const Matrix<4,C,T> & b){
+    // The product with the loops, summed in the same order as operator*
+    Matrix<4,C,T> res;
+    for(int i = 0; i < 4; i++)
+        for(int j = 0; j < C; j++){
+            T sum = a.m[i][0]*b.m[0][j];
+            for(int k = 1; k < 4; k++)
+                sum += a.m[i][k]*b.m[k][j];
+            res.m[i][j] = sum;
+        }
+    return res;
+}
+
+template <typename T>
+int matrix_differences(int tries){
+    // Multiplies random matrices and columns with operator* and with the loops, returns how many values differ
+    int differ = 0;
+    for(int t = 0; t < tries; t++){
+        Matrix<4,4,T> a, b;
+        Matrix<4,1,T> v;
+        for(int i = 0; i < 4; i++){
+            for(int j = 0; j < 4; j++){
+                a.m[i][j] = (T)((rand()%20001-10000)/997.0);
+                b.m[i][j] = (T)((rand()%20001-10000)/991.0);
+            }
+            v.m[i][0] = (T)((rand()%20001-10000)/983.0);
+        }
+        Matrix<4,4,T> product = a*b, expected = plain_product(a,b);
+        Matrix<4,1,T> column = a*v, expected_column = plain_product(a,v);
+        differ += memcmp(&product,&expected,sizeof(product)) != 0;
+        differ += memcmp(&column,&expected_column,sizeof(column)) != 0;
+    }
+    return differ;
+}
+
+void test_matrix_kernels(){
+    // The SSE products of 4x4 matrices give the same values as the plain loops, for floats and doubles
+
+    srand(5);
+    int differ = matrix_differences<double>(1000);
+    check(differ == 0,"%d products of double matrices differ from the loops",differ);
+    differ = matrix_differences<float>(1000);
+    check(differ == 0,"%d products of float matrices differ from the loops",differ);
+
+    // A point through a transformation, and a product worked out while compiling
+    Point position(3,-2,10), direction(-0.2,0.1,-1);
+    Transform * camera = transform_view_per(&position,&direction,40);
+    const Mat4 & m = camera->getMatrix();
+    Vec4 p = m*Vec4(1.5,-2.25,-7,1);
+    Matrix<4,1,double> column;
+    column.m[0][0] = 1.5;
+    column.m[1][0] = -2.25;
+    column.m[2][0] = -7;
+    column.m[3][0] = 1;
+    Matrix<4,1,double> expected = plain_product(m,column);
+    check(p.x == expected.m[0][0] && p.y == expected.m[1][0] && p.z == expected.m[2][0] && p.w == expected.m[3][0],
+        "A point transformed by a matrix differs from the loops");
+    delete camera;
+    constexpr Mat4 folded = matrix_translate(1,2,3)*matrix_per(7)*matrix_scale(2,3,4);
+    Mat4 a = matrix_translate(1,2,3), b = matrix_scale(2,3,4);
+    Mat4 runtime = a*matrix_per(7)*b;
+    check(memcmp(&folded,&runtime,sizeof(Mat4)) == 0,"A product worked out while compiling differs from the one at run time");
+
+}
+
+long color_distance(Color a, Color b){
+    // The distance the palettes use, green weighs most
+    long dr = a.r-b.r, dg = a.g-b.g, db = a.b-b.b;
+    return 2*dr*dr+4*dg*dg+3*db*db;
+}
+
+void test_palettes(){
+    // The table of a palette finds the color a search of the whole palette finds, in the middle of every cell,
+    // and anywhere else one no further than the size of a cell allows
+
+    for(const Palette * palette : {palette_16(),palette_256()}){
+        int n = palette->getColorNo(), wrong = 0, far = 0;
+        for(int cell = 0; cell < 32*32*32; cell++){
+            Color middle = color_bytes((cell>>10)*8+4,((cell>>5)&31)*8+4,(cell&31)*8+4);
+            int best = 0;
+            for(int i = 1; i < n; i++)
+                if(color_distance(middle,palette->getColor(i)) < color_distance(middle,palette->getColor(best))) best = i;
+            if(palette->nearest(middle) != best) wrong++;
+        }
+        check(wrong == 0,"The table of a palette of %d colors is wrong in %d cells",n,wrong);
+
+        // A color is at most 4 steps from the middle of its cell on every channel, so at a distance of 144,
+        // and the one picked for the middle can be at most twice that further than the nearest one
+        srand(3);
+        for(int t = 0; t < 20000; t++){
+            Color c = color_bytes(rand()%256,rand()%256,rand()%256);
+            long best = color_distance(c,palette->getColor(0));
+            for(int i = 1; i < n; i++)
+                best = std::min(best,color_distance(c,palette->getColor(i)));
+            if(sqrt(color_distance(c,palette->getColor(palette->nearest(c)))) > sqrt(best)+24) far++;
+        }
+        check(far == 0,"A palette of %d colors picks %d colors too far from the nearest one",n,far);
+    }
+
+    // Packing keeps every channel in its own byte, and the color converts to floats and back unchanged
+    int wrong = 0;
+    for(int v = 0; v < 256; v++)
+        for(int channel = 0; channel < 4; channel++){
+            unsigned char b[4] = {17,99,201,255};
+            b[channel] = v;
+            Color c = color_bytes(b[0],b[1],b[2],b[3]);
+            uint32_t p = c.packed();
+            Color back = color_bytes(p&255,(p>>8)&255,(p>>16)&255,p>>24);
+            if(back != c || back.r != b[0] || back.g != b[1] || back.b != b[2] || back.a != b[3]) wrong++;
+            if(Color(ColorF(c)) != c || Color(c.getRed(),c.getGreen(),c.getBlue(),c.getAlpha()) != c) wrong++;
+        }
+    check(wrong == 0,"%d colors don't pack and unpack to the same channels",wrong);
+    check(color_bytes(1,2,3,4) != color_bytes(1,2,3,5) && color_bytes(1,2,3) == Color(1/255.0,2/255.0,3/255.0),
+        "Colors that differ in one channel compare the same");
+
+}
+
+struct alignas(32) Wide{
+    // An object with more alignment than new gives by default, that counts how many are alive
+    static int alive;
+    double values[3];
+    Wide(double v = 0) : values{v,v,v}{ alive++; }
+    ~Wide(){ alive--; }
+};
+
+int Wide::alive = 0;
+
+void test_arena(){
+    // The arena gives aligned memory that doesn't overlap, and after a reset the same memory again
+
+    Arena * arena = new Arena(256);
+    std::vector<char *> frames[2];
+    size_t reserved = 0;
+    for(int frame = 0; frame < 2; frame++){
+        // Sizes and alignments that fill several blocks, and a request bigger than a block
+        std::vector<std::pair<char *,int>> given;
+        int misaligned = 0;
+        for(int i = 0; i < 60; i++){
+            int size = (i == 30)?1000:1+i%23;
+            size_t align = (size_t)1<<(i%7);
+            char * p = (char *)arena->allocate(size,align);
+            if((size_t)p%align) misaligned++;
+            memset(p,i,size);
+            given.push_back({p,size});
+            frames[frame].push_back(p);
+        }
+        int overwritten = 0;
+        for(int i = 0; i < 60; i++)
+            for(int k = 0; k < given[i].second; k++)
+                if(given[i].first[k] != (char)i) overwritten++;
+        check(misaligned == 0 && overwritten == 0,"Arena frame %d: %d allocations misaligned, %d bytes overwritten",
+            frame,misaligned,overwritten);
+        check(arena->getAllocations() == 60,"Arena frame %d counts %ld allocations of 60",frame,arena->getAllocations());
+
+        Wide * wide = arena->make<Wide>(2.5);
+        Wide * wides = arena->make_array<Wide>(3);
+        check((size_t)wide%32 == 0 && (size_t)wides%32 == 0 && wide->values[2] == 2.5 && wides[2].values[0] == 0,
+            "Arena frame %d: objects aligned to 32 are placed at %p and %p",frame,(void *)wide,(void *)wides);
+        Wide::alive -= 4; // The arena never destroys them
+
+        size_t live = arena->getLiveBytes();
+        arena->reset();
+        check(arena->getLiveBytes() == 0 && arena->getAllocations() == 0 && arena->getLastFrameBytes() == live &&
+            arena->getLastFrameAllocations() == 62,"A reset arena counts %zu bytes and %ld allocations, the frame before %zu and %ld",
+            arena->getLiveBytes(),arena->getAllocations(),arena->getLastFrameBytes(),arena->getLastFrameAllocations());
+        if(frame == 0) reserved = arena->getReservedBytes();
+    }
+    check(frames[0] == frames[1] && arena->getReservedBytes() == reserved,
+        "The frame after a reset does not reuse the memory of the first (%zu bytes reserved, then %zu)",
+        reserved,arena->getReservedBytes());
+    delete arena;
+
+}
+
+void test_pool(){
+    // A pool gives aligned slots, and a destroyed object's slot is the next one given out
+
+    Pool<Wide> * pool = new Pool<Wide>(8);
+    std::vector<Wide *> objects;
+    int misaligned = 0;
+    for(int i = 0; i < 20; i++){
+        objects.push_back(pool->create(i));
+        if((size_t)objects.back()%32) misaligned++;
+    }
+    std::vector<Wide *> sorted = objects;
+    std::sort(sorted.begin(),sorted.end());
+    bool distinct = std::adjacent_find(sorted.begin(),sorted.end()) == sorted.end();
+    check(misaligned == 0 && distinct,"A pool of 20 objects has %d misaligned ones%s",misaligned,distinct?"":", and some share slots");
+    check(pool->getLiveObjects() == 20 && Wide::alive == 20,"A pool of 20 objects counts %ld, %d are alive",
+        pool->getLiveObjects(),Wide::alive);
+
+    // Destroyed objects are gone, and their slots come back last freed first, before any new ones
+    for(int i : {3,11,17})
+        pool->destroy(objects[i]);
+    pool->destroy(nullptr);
+    check(pool->getLiveObjects() == 17 && Wide::alive == 17 && pool->getLiveBytes() == 17*sizeof(Wide),
+        "A pool counts %ld objects after destroying 3 of 20, %d are alive",pool->getLiveObjects(),Wide::alive);
+    Wide * again[3];
+    for(int k = 0; k < 3; k++)
+        again[k] = pool->create(100+k);
+    check(again[0] == objects[17] && again[1] == objects[11] && again[2] == objects[3] && again[0]->values[1] == 100,
+        "A pool does not give back the freed slots first");
+    objects[3] = again[2];
+    objects[11] = again[1];
+    objects[17] = again[0];
+
+    // The rest of the last chunk (the 17th object onwards) is used before a new one
+    Wide * next = pool->create();
+    check(std::find(objects.begin(),objects.end(),next) == objects.end() &&
+        std::abs(next-objects[16]) < 8,"A pool with free slots in a chunk makes a new one");
+    objects.push_back(next);
+    for(Wide * object : objects)
+        pool->destroy(object);
+    check(pool->getLiveObjects() == 0 && Wide::alive == 0,"An emptied pool counts %ld objects, %d are alive",
+        pool->getLiveObjects(),Wide::alive);
+    delete pool;
+
+}
+
+int main(){
+
+    test_line_steps();
+    test_threads();
+    test_behind_camera();
+    test_huge_triangle();
+    test_rotated_grid();
+    test_filled_shapes();
+    test_culled_wireframe();
+    test_front_sign();
+    test_letters();
+    test_dithering();
+    test_palettes();
+    test_transform_slots();
+    test_arena();
+    test_pool();
+    test_mesh_file();
+    test_loaders();
+    test_emitter_pipe();
+    test_emitter_diff();
+    test_recorder();
+    test_matrix_kernels();
+    test_batch_kernels();
+    test_depth();
+
+    if(failures) fprintf(stderr,"%d checks failed\n",failures);
+    else printf("All checks passed\n");
+    return failures?1:0;
+
+}
@@ -0,0 +1,158 @@
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <functional>
+
+#ifndef _threadpooll
+#define _threadpooll
+
+class ThreadPool{
+    // This is a pool of threads that run numbered tasks in parallel with work stealing.
+    // Every thread has its own queue of tasks. It takes tasks from the back of its own queue
+    // and when that runs out it steals from the front of the others.
+    // The thread that calls run takes part as well, so a pool of n threads starts n-1 workers.
+
+    private:
+
+        struct TaskQueue{
+            std::mutex lock;
+            std::deque<int> tasks;
+        };
+
+        int thread_no; // How many threads run tasks, the caller included
+        std::thread * workers; // The extra threads
+        TaskQueue * queues; // One queue per thread, the caller has the first one
+
+        // The job that is being run at the moment
+        std::function<void(int)> job;
+        std::atomic<int> remaining; // Tasks that have not finished yet
+
+        // Used to wake up the workers and to wait for them
+        std::mutex lock;
+        std::condition_variable wake, done;
+        long generation; // Changes for every job, so the workers know there is something new
+        bool stopping;
+
+        bool take(int id, int & task){
+            // Takes a task from the own queue, or steals one from the others
+
+            {
+                std::lock_guard<std::mutex> guard(queues[id].lock);
+                if(!queues[id].tasks.empty()){
+                    task = queues[id].tasks.back();
+                    queues[id].tasks.pop_back();
+                    return true;
+                }
+            }
+
+            for(int k = 1; k < thread_no; k++){
+                TaskQueue & other = queues[(id+k)%thread_no];
+                std::lock_guard<std::mutex> guard(other.lock);
+                if(!other.tasks.empty()){
+                    task = other.tasks.front();
+                    other.tasks.pop_front();
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        void run_tasks(int id){
+            // Runs tasks until there are none left anywhere
+            int task;
+            while(take(id,task)){
+                job(task);
+                if(remaining.fetch_sub(1) == 1){
+                    std::lock_guard<std::mutex> guard(lock);
+                    done.notify_all();
+                }
+            }
+        }
+
+        void work(int id){
+            // The loop of every worker, sleeps until there is a new job
+
+            long seen = 0;
+            while(true){
+                {
+                    std::unique_lock<std::mutex> guard(lock);
+                    wake.wait(guard,[&]{ return stopping || generation != seen; });
+                    if(stopping) return;
+                    seen = generation;
+                }
+                run_tasks(id);
+            }
+
+        }
+
+    public:
+
+        ThreadPool(int threads){
+            // Creates the pool and starts the workers
+
+            thread_no = (threads > 1)?threads:1;
+            queues = new TaskQueue[thread_no];
+            remaining = 0;
+            generation = 0;
+            stopping = false;
+
+            workers = new std::thread[thread_no-1];
+            for(int i = 1; i < thread_no; i++)
+                workers[i-1] = std::thread(&ThreadPool::work,this,i);
+
+        }
+
+        ~ThreadPool(){
+
+            // Wake everyone up to stop, then wait for them
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                stopping = true;
+            }
+            wake.notify_all();
+            for(int i = 0; i < thread_no-1; i++)
+                workers[i].join();
+
+            delete[] workers;
+            delete[] queues;
+
+        }
+
+        void run(int tasks, const std::function<void(int)> & function){
+            // Runs function(0) to function(tasks-1) on the pool and returns when all are done
+
+            if(tasks <= 0) return;
+            job = function;
+            remaining = tasks;
+
+            // Spread the tasks over the queues
+            for(int i = 0; i < tasks; i++){
+                TaskQueue & q = queues[i%thread_no];
+                std::lock_guard<std::mutex> guard(q.lock);
+                q.tasks.push_back(i);
+            }
+
+            // Wake the workers and help them
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                generation++;
+            }
+            wake.notify_all();
+            run_tasks(0);
+
+            // Wait for the tasks that were taken by others
+            std::unique_lock<std::mutex> guard(lock);
+            done.wait(guard,[&]{ return remaining == 0; });
+
+        }
+
+        int getThreadNo(){
+            return thread_no;
+        }
+
+};
+
+#endif